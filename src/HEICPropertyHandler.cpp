@@ -0,0 +1,211 @@
+#include <shlwapi.h>
+#include <propsys.h>
+#include <initguid.h>   // define the PKEY_ values used below
+#include <propkey.h>
+#include <propvarutil.h>
+#include <strsafe.h>
+#include <new>
+
+#include "probe.h"
+#include "stats.h"
+#include "log.h"
+
+#pragma comment(lib, "propsys.lib")
+
+// this property handler provides the Dimensions, Date taken, Orientation etc
+// columns from the metadata boxes only, no image data is ever decoded
+
+class CHEICPropertyStore : public IInitializeWithStream,
+    public IPropertyStore,
+    public IPropertyStoreCapabilities
+{
+public:
+    CHEICPropertyStore() : _cRef(1), _pCache(NULL)
+    {
+    }
+
+    virtual ~CHEICPropertyStore()
+    {
+        if (_pCache)
+        {
+            _pCache->Release();
+        }
+    }
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        static const QITAB qit[] =
+        {
+            QITABENT(CHEICPropertyStore, IInitializeWithStream),
+            QITABENT(CHEICPropertyStore, IPropertyStore),
+            QITABENT(CHEICPropertyStore, IPropertyStoreCapabilities),
+            { 0 },
+        };
+        return QISearch(this, qit, riid, ppv);
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        ULONG cRef = InterlockedDecrement(&_cRef);
+        if (!cRef)
+        {
+            delete this;
+        }
+        return cRef;
+    }
+
+    // IInitializeWithStream
+    IFACEMETHODIMP Initialize(IStream* pStream, DWORD grfMode);
+
+    // IPropertyStore
+    IFACEMETHODIMP GetCount(DWORD* pcProps)
+    {
+        *pcProps = 0;
+        return _pCache ? _pCache->GetCount(pcProps) : E_UNEXPECTED;
+    }
+
+    IFACEMETHODIMP GetAt(DWORD iProp, PROPERTYKEY* pkey)
+    {
+        return _pCache ? _pCache->GetAt(iProp, pkey) : E_UNEXPECTED;
+    }
+
+    IFACEMETHODIMP GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+    {
+        PropVariantInit(pPropVar);
+        return _pCache ? _pCache->GetValue(key, pPropVar) : E_UNEXPECTED;
+    }
+
+    IFACEMETHODIMP SetValue(REFPROPERTYKEY, REFPROPVARIANT)
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    IFACEMETHODIMP Commit()
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    // IPropertyStoreCapabilities
+    IFACEMETHODIMP IsPropertyWritable(REFPROPERTYKEY)
+    {
+        return S_FALSE;
+    }
+
+private:
+
+    HRESULT SetCacheValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar);
+
+    long _cRef;
+    IPropertyStore* _pCache;    // values read during initialization.
+};
+
+HRESULT CHEICPropertyStore_CreateInstance(REFIID riid, void** ppv)
+{
+    CHEICPropertyStore* pNew = new (std::nothrow) CHEICPropertyStore();
+    HRESULT hr = pNew ? S_OK : E_OUTOFMEMORY;
+    if (SUCCEEDED(hr))
+    {
+        hr = pNew->QueryInterface(riid, ppv);
+        pNew->Release();
+    }
+    return hr;
+}
+
+// takes ownership of the contents of pPropVar
+HRESULT CHEICPropertyStore::SetCacheValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+{
+    HRESULT hr = _pCache->SetValue(key, *pPropVar);
+    PropVariantClear(pPropVar);
+    return hr;
+}
+
+// IInitializeWithStream
+IFACEMETHODIMP CHEICPropertyStore::Initialize(IStream* pStream, DWORD)
+{
+    Log_WriteFmt(LOG_TRACE, L"CHEICPropertyStore::Initialize");
+
+    if (_pCache)
+        return E_UNEXPECTED;  // can only be inited once
+
+    LONG64 probe_start = Stats_Now();
+    Stats_Add(STAT_PROPERTY_REQUESTS);
+
+    HEIF_PROBE_INFO info;
+    HRESULT hr = Probe_ReadStream(pStream, &info);
+
+    Stats_AddTime(STAT_TIME_PROBE, probe_start);
+    Stats_Add(STAT_BYTES_READ, info.bytes_read);
+    if (FAILED(hr))
+        Stats_Add(STAT_FAILED_REQUESTS);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = PSCreateMemoryPropertyStore(IID_PPV_ARGS(&_pCache));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        PROPVARIANT pv;
+
+        hr = InitPropVariantFromUInt32(info.width, &pv);
+        if (SUCCEEDED(hr))
+            hr = SetCacheValue(PKEY_Image_HorizontalSize, &pv);
+
+        if (SUCCEEDED(hr))
+            hr = InitPropVariantFromUInt32(info.height, &pv);
+        if (SUCCEEDED(hr))
+            hr = SetCacheValue(PKEY_Image_VerticalSize, &pv);
+
+        if (SUCCEEDED(hr))
+        {
+            WCHAR szDimensions[32];
+            hr = StringCchPrintfW(szDimensions, ARRAYSIZE(szDimensions), L"%i x %i", info.width, info.height);
+            if (SUCCEEDED(hr))
+                hr = InitPropVariantFromString(szDimensions, &pv);
+            if (SUCCEEDED(hr))
+                hr = SetCacheValue(PKEY_Image_Dimensions, &pv);
+        }
+
+        if (SUCCEEDED(hr) && info.bit_depth > 0)
+        {
+            // bits per pixel, as reported for other image types
+            hr = InitPropVariantFromUInt32(info.bit_depth * (info.has_alpha ? 4 : 3), &pv);
+            if (SUCCEEDED(hr))
+                hr = SetCacheValue(PKEY_Image_BitDepth, &pv);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            // libheif applies the irot/imir transforms to the reported size and the
+            // decoded thumbnail, so the image is always upright as shown. The Exif
+            // orientation describes the untransformed sensor image and is ignored,
+            // otherwise Explorer would rotate it a second time.
+            hr = InitPropVariantFromUInt16(PHOTO_ORIENTATION_NORMAL, &pv);
+            if (SUCCEEDED(hr))
+                hr = SetCacheValue(PKEY_Photo_Orientation, &pv);
+        }
+
+        if (SUCCEEDED(hr) && info.has_date_taken)
+        {
+            hr = InitPropVariantFromFileTime(&info.date_taken, &pv);
+            if (SUCCEEDED(hr))
+                hr = SetCacheValue(PKEY_Photo_DateTaken, &pv);
+        }
+
+        if (FAILED(hr))
+        {
+            Log_WriteFmt(LOG_ERROR, L"Could not set property value: 0x%08x", hr);
+
+            _pCache->Release();
+            _pCache = NULL;
+        }
+    }
+
+    return hr;
+}
@@ -0,0 +1,179 @@
+// Prints the counters kept by HEICThumbnailHandler.dll in its shared memory block.
+//
+// HEICStats         print once
+// HEICStats -w [ms] print every ms milliseconds (default 1000) until Ctrl+C
+//
+// It also builds on Linux with tests/compat (make -C tests), where the block is
+// a POSIX shared memory object, to read the stats of the Linux tests and benchmarks.
+
+#include <windows.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "../stats.h"
+
+const PCWSTR counter_names[STAT_COUNTER_MAX] =
+{
+    L"thumbnail requests",
+    L"property requests",
+    L"source: thumbnail",
+    L"source: primary",
+    L"hdr decodes",
+    L"bytes read",
+    L"failed requests",
+    L"rejected: filetype",
+    L"rejected: limits",
+};
+
+const PCWSTR timer_names[STAT_TIMER_MAX] =
+{
+    L"total",
+    L"read",
+    L"decode",
+    L"tonemap",
+    L"scale",
+    L"probe",
+    L"sniff",
+};
+
+// indexed by heif_error_code
+const PCWSTR error_names[STATS_ERROR_CODES] =
+{
+    L"ok",
+    L"input does not exist",
+    L"invalid input",
+    L"unsupported filetype",
+    L"unsupported feature",
+    L"usage error",
+    L"memory allocation error",
+    L"decoder plugin error",
+    L"encoder plugin error",
+    L"encoding error",
+    L"color profile does not exist",
+    NULL, NULL, NULL, NULL,
+    L"other",
+};
+
+// Totals of all slots. Slots are read without synchronization, so a snapshot
+// may be a few increments out of step between counters, but never torn.
+void Stats_Sum(const STATS_BLOCK* block, STATS_SLOT* total)
+{
+    ZeroMemory(total, sizeof(*total));
+
+    for (UINT s = 0; s < STATS_SLOT_COUNT; ++s)
+    {
+        const STATS_SLOT* slot = &block->slots[s];
+
+        for (UINT i = 0; i < STAT_COUNTER_MAX; ++i)
+            total->counters[i] += ReadNoFence64(&slot->counters[i]);
+
+        for (UINT i = 0; i < STATS_ERROR_CODES; ++i)
+            total->failures[i] += ReadNoFence64(&slot->failures[i]);
+
+        for (UINT t = 0; t < STAT_TIMER_MAX; ++t)
+        {
+            total->time_total_us[t] += ReadNoFence64(&slot->time_total_us[t]);
+            for (UINT i = 0; i < STATS_TIME_BUCKETS; ++i)
+                total->time_buckets[t][i] += ReadNoFence64(&slot->time_buckets[t][i]);
+        }
+    }
+}
+
+// Upper bound of the bucket containing the given fraction of samples
+LONG64 Stats_Percentile(const LONG64* buckets, LONG64 count, double fraction)
+{
+    LONG64 target = (LONG64)(count * fraction);
+    LONG64 seen = 0;
+    for (UINT i = 0; i < STATS_TIME_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen > target)
+            return 1ll << i;
+    }
+    return 1ll << (STATS_TIME_BUCKETS - 1);
+}
+
+void Stats_Print(const STATS_BLOCK* block)
+{
+    STATS_SLOT total;
+    Stats_Sum(block, &total);
+
+    for (UINT i = 0; i < STAT_COUNTER_MAX; ++i)
+        wprintf(L"%-28ls %12lld\n", counter_names[i], total.counters[i]);
+
+    wprintf(L"%-28ls %12lld\n", L"bytes in flight", ReadNoFence64(&block->bytes_in_flight));
+    wprintf(L"%-28ls %12lld\n", L"peak bytes in flight", ReadNoFence64(&block->peak_bytes_in_flight));
+
+    wprintf(L"\nfailures by libheif error\n");
+    for (UINT i = 0; i < STATS_ERROR_CODES; ++i)
+    {
+        if (total.failures[i])
+            wprintf(L"  %-26ls %12lld\n", error_names[i] ? error_names[i] : L"?", total.failures[i]);
+    }
+
+    wprintf(L"\n%-10ls %10ls %10ls %10ls %10ls\n", L"time (us)", L"count", L"mean", L"p50 <", L"p99 <");
+    for (UINT t = 0; t < STAT_TIMER_MAX; ++t)
+    {
+        LONG64 count = 0;
+        for (UINT i = 0; i < STATS_TIME_BUCKETS; ++i)
+            count += total.time_buckets[t][i];
+
+        if (count == 0)
+            continue;
+
+        wprintf(L"%-10ls %10lld %10lld %10lld %10lld\n", timer_names[t], count,
+            total.time_total_us[t] / count,
+            Stats_Percentile(total.time_buckets[t], count, 0.50),
+            Stats_Percentile(total.time_buckets[t], count, 0.99));
+    }
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    DWORD interval_ms = 0;
+    if (argc > 1 && _wcsicmp(argv[1], L"-w") == 0)
+    {
+        interval_ms = (argc > 2) ? wcstoul(argv[2], NULL, 10) : 1000;
+        if (interval_ms == 0)
+            interval_ms = 1000;
+    }
+
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, SZ_STATS_MAPPING_NAME);
+    if (!hMapping)
+    {
+        wprintf(L"No stats available, the handler has not been loaded in this session (0x%08x)\n", GetLastError());
+        return 1;
+    }
+
+    const STATS_BLOCK* block = (const STATS_BLOCK*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, sizeof(STATS_BLOCK));
+    if (!block)
+    {
+        wprintf(L"Could not map stats: 0x%08x\n", GetLastError());
+        CloseHandle(hMapping);
+        return 1;
+    }
+
+    int result = 0;
+    if (block->version != STATS_VERSION || block->slot_count != STATS_SLOT_COUNT)
+    {
+        wprintf(L"Stats version %u does not match this tool (%u)\n", block->version, STATS_VERSION);
+        result = 1;
+    }
+    else
+    {
+        for (;;)
+        {
+            Stats_Print(block);
+
+            if (!interval_ms)
+                break;
+
+            Sleep(interval_ms);
+            wprintf(L"\n");
+        }
+    }
+
+    UnmapViewOfFile(block);
+    CloseHandle(hMapping);
+    return result;
+}
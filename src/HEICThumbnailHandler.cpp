@@ -5,10 +5,19 @@
 #include <libheif/heif.h>
 
 #include "log.h"
+#include "scale.h"
+#include "tonemap.h"
+#include "stats.h"
+#include "sniff.h"
+#include "streamreader.h"
 
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "Pathcch.lib")
 
+// Largest image decoded at 16 bits per channel (256 MB of RGBA), larger high bit
+// depth images are decoded at 8 bits so they need no more than an SDR image
+const UINT64 HDR_MAX_FULL_DEPTH_PIXELS = 32 * 1000000;
+
 // this thumbnail provider implements IInitializeWithStream to enable being hosted
 // in an isolated process for robustness
 
@@ -133,7 +142,7 @@ IFACEMETHODIMP CHEICThumbProvider::Initialize(IStream* pStream, DWORD)
 //    return hr;
 //}
 
-HRESULT CreateDIBFromData(HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha, const uint8_t* src_data, int thumbnail_width, int thumbnail_height, int src_stride)
+HRESULT CreateThumbnailDIB(HBITMAP* phbmp, BYTE** ppBits, UINT* pStride, int thumbnail_width, int thumbnail_height)
 {
     HRESULT hr = E_FAIL;
 
@@ -155,25 +164,9 @@ HRESULT CreateDIBFromData(HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha, const uint8_t
     hr = hbmp ? S_OK : E_OUTOFMEMORY;
     if (SUCCEEDED(hr))
     {
-        for (UINT y = 0; y < nHeight; ++y)
-        {
-            // 0xAARRGGBB
-            DWORD* dest_row = reinterpret_cast<DWORD*>(&dest_data[y * dest_stride]);
-
-            // 0xAABBGGRR
-            const DWORD* src_row = reinterpret_cast<const DWORD*>(&src_data[y * src_stride]);
-
-            for (UINT x = 0; x < nWidth; ++x)
-            {
-                dest_row[x] = 
-                    (src_row[x] & 0xFF000000) | 
-                    ((src_row[x] & 0x00FF0000) >> 16) |
-                    (src_row[x] & 0x0000FF00) | 
-                    ((src_row[x] & 0x000000FF) << 16);
-            }
-        }
         *phbmp = hbmp;
-        *pdwAlpha = WTSAT_ARGB;
+        *ppBits = dest_data;
+        *pStride = dest_stride;
     }
     else
     {
@@ -181,151 +174,256 @@ HRESULT CreateDIBFromData(HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha, const uint8_t
     }
 
     return hr;
+}
+
+// Streams the decoded RGBA image through the row scaler straight into a new DIB,
+// so no full size intermediate copy of the scaled or converted image is made.
+// High bit depth images are reduced to 8 bits through tonemap only after scaling.
+HRESULT CreateDIBFromImage(HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha, const heif_image* image, UINT requested_size, int bit_depth, const TONEMAP* tonemap)
+{
+    int input_width = heif_image_get_width(image, heif_channel_interleaved);
+    int input_height = heif_image_get_height(image, heif_channel_interleaved);
+
+    int src_stride = 0;
+    const uint8_t* src_data = heif_image_get_plane_readonly(image, heif_channel_interleaved, &src_stride);
+    if (!src_data || input_width <= 0 || input_height <= 0)
+        return E_FAIL;
+
+    int thumbnail_width = input_width;
+    int thumbnail_height = input_height;
+
+    if (input_width > (int)requested_size || input_height > (int)requested_size)
+    {
+        if (input_width > input_height)
+        {
+            thumbnail_height = max(1, (int)((INT64)input_height * requested_size / input_width));
+            thumbnail_width = requested_size;
+        }
+        else // (input_width <= input_height)
+        {
+            thumbnail_width = max(1, (int)((INT64)input_width * requested_size / input_height));
+            thumbnail_height = requested_size;
+        }
+
+        Log_WriteFmt(LOG_INFO, L"scaling image (%i, %i) to (%i, %i)", input_width, input_height, thumbnail_width, thumbnail_height);
+    }
+
+    HBITMAP hbmp = NULL;
+    BYTE* dest_data = NULL;
+    UINT dest_stride = 0;
+    HRESULT hr = CreateThumbnailDIB(&hbmp, &dest_data, &dest_stride, thumbnail_width, thumbnail_height);
+    if (SUCCEEDED(hr))
+    {
+        LONG64 scale_start = Stats_Now();
 
+        CRowScaler scaler;
+        hr = scaler.Init(input_width, input_height, thumbnail_width, thumbnail_height, dest_data, dest_stride, bit_depth, tonemap);
+        if (SUCCEEDED(hr))
+        {
+            for (int y = 0; y < input_height; ++y)
+            {
+                scaler.PushRow(&src_data[(SIZE_T)y * src_stride]);
+            }
+            hr = scaler.IsComplete() ? S_OK : E_FAIL;
+
+            Stats_AddTime(STAT_TIME_SCALE, scale_start);
+        }
+        else
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not scale HEIF image: 0x%08x", hr);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            *phbmp = hbmp;
+            *pdwAlpha = WTSAT_ARGB;
+        }
+        else
+        {
+            DeleteObject(hbmp);
+        }
+    }
+
+    return hr;
 }
+
 // IThumbnailProvider
 IFACEMETHODIMP CHEICThumbProvider::GetThumbnail(UINT requested_size, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha)
 {
     Log_WriteFmt(LOG_TRACE, L"CHEICThumbProvider::GetThumbnail(%u)", requested_size);
 
-    ULARGE_INTEGER ulSize;
+    LONG64 total_start = Stats_Now();
+    Stats_Add(STAT_THUMBNAIL_REQUESTS);
 
     HRESULT final_hr = E_FAIL;
 
-    HRESULT hr = IStream_Size(_pStream, &ulSize);
+    HEIF_STREAM_READER sr;
+    HRESULT hr = StreamReader_Init(&sr, _pStream, MAXUINT64);
     if (SUCCEEDED(hr))
     {
-        Log_WriteFmt(LOG_DEBUG, L"stream size {%u, %u}", ulSize.HighPart, ulSize.LowPart);
+        Log_WriteFmt(LOG_DEBUG, L"stream size: %I64u", sr.size);
+
+        // reject files which aren't HEIF, or are over the limits, before parsing them;
+        // the bytes read doing so count too
+        ULONG cbSniffed = 0;
+        hr = Sniff_CheckStream(_pStream, sr.size, &cbSniffed);
+        sr.bytes_read += cbSniffed;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        LONG64 read_start = Stats_Now();
+
+        // parse the boxes straight from the stream, only the data of the item
+        // which is decoded is read later on, the file is never held in memory
+        heif_context* ctx = heif_context_alloc();
+        heif_error err = heif_context_read_from_reader(ctx, StreamReader_GetReader(), &sr, nullptr);
+
+        Stats_AddTime(STAT_TIME_READ, read_start);
 
-        if (ulSize.HighPart == 0)
+        // --- get primary image
+        struct heif_image_handle* image_handle = NULL;
+        if (!err.code)
         {
-            void* ptr = LocalAlloc(LPTR, ulSize.LowPart);
-            if (ptr)
+            err = heif_context_get_primary_image_handle(ctx, &image_handle);
+        }
+        bool is_thumbnail = false;
+        if (err.code) 
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not read HEIF image: %S", err.message);
+            Stats_AddFailure(err.code);
+        }
+        else
+        {
+            heif_item_id thumbnail_ID;
+            int nThumbnails = heif_image_handle_get_list_of_thumbnail_IDs(image_handle, &thumbnail_ID, 1);
+            if (nThumbnails > 0) 
             {
-                ULONG ulRead = 0;
-                hr = _pStream->Read(ptr, ulSize.LowPart, &ulRead);
-                if (SUCCEEDED(hr))
+                Log_WriteFmt(LOG_DEBUG, L"Image has thumbnails: %i", nThumbnails);
+
+                struct heif_image_handle* thumbnail_handle;
+                err = heif_image_handle_get_thumbnail(image_handle, thumbnail_ID, &thumbnail_handle);
+                if (err.code) 
+                {
+                    Log_WriteFmt(LOG_WARNING, L"Could not read HEIF thumbnail: %S", err.message);
+                }
+                else
                 {
-                    Log_WriteFmt(LOG_DEBUG, L"stream read: %u", ulRead);
-
-                    heif_context* ctx = heif_context_alloc();
-                    heif_context_read_from_memory_without_copy(ctx, ptr, ulSize.LowPart, nullptr);
-
-                    // --- get primary image
-                    struct heif_image_handle* image_handle = NULL;
-                    heif_error err = heif_context_get_primary_image_handle(ctx, &image_handle);
-                    if (err.code) 
-                    {
-                        Log_WriteFmt(LOG_WARNING, L"Could not read HEIF image: %S", err.message);
-                    }
-                    else
-                    {
-                        heif_item_id thumbnail_ID;
-                        int nThumbnails = heif_image_handle_get_list_of_thumbnail_IDs(image_handle, &thumbnail_ID, 1);
-                        if (nThumbnails > 0) 
-                        {
-                            Log_WriteFmt(LOG_DEBUG, L"Image has thumbnails: %i", nThumbnails);
-
-                            struct heif_image_handle* thumbnail_handle;
-                            err = heif_image_handle_get_thumbnail(image_handle, thumbnail_ID, &thumbnail_handle);
-                            if (err.code) 
-                            {
-                                Log_WriteFmt(LOG_WARNING, L"Could not read HEIF thumbnail: %S", err.message);
-                            }
-                            else
-                            {
-                                // replace image handle with thumbnail handle
-                                heif_image_handle_release(image_handle);
-                                image_handle = thumbnail_handle;
-                            }
-                        }
-                    }
-
-                    if (image_handle)
-                    {
-                        struct heif_decoding_options* decode_options = heif_decoding_options_alloc();
-                        decode_options->convert_hdr_to_8bit = true;
-
-                        int bit_depth = 8;
-
-                        struct heif_image* image = NULL;
-                        err = heif_decode_image(image_handle, &image, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, decode_options);
-                        if (err.code) 
-                        {
-                            Log_WriteFmt(LOG_WARNING, L"Could not decode HEIF image: %S", err.message);
-                        }
-                        else
-                        {
-                            int input_width = heif_image_handle_get_width(image_handle);
-                            int input_height = heif_image_handle_get_height(image_handle);
-
-                            Log_WriteFmt(LOG_DEBUG, L"HEIF image/thumb size: %i x %i", input_width, input_height);
-
-                            int thumbnail_width = input_width;
-                            int thumbnail_height = input_height;
-
-                            bool scale_error = false;
-                            if (input_width > (int)requested_size || input_height > (int)requested_size)
-                            {
-                                int scaled_w = input_width;
-                                int scaled_h = input_height;
-
-                                if (input_width > input_height)
-                                {
-                                    scaled_h = input_height * requested_size / input_width;
-                                    scaled_w = requested_size;
-                                }
-                                else // (input_width <= input_height)
-                                {
-                                    scaled_w = input_width * requested_size / input_height;
-                                    scaled_h = requested_size;
-                                }
-
-                                Log_WriteFmt(LOG_INFO, L"scaling image (%i, %i) to (%i, %i)", input_width, input_height, scaled_w, scaled_h);
-
-                                struct heif_image* scaled_image = NULL;
-                                err = heif_image_scale_image(image, &scaled_image, scaled_w, scaled_h, NULL);
-                                if (err.code) 
-                                {
-                                    Log_WriteFmt(LOG_WARNING, L"Could not scale HEIF image: %S", err.message);
-                                    scale_error = true;
-                                }
-                                else
-                                {
-                                    heif_image_release(image);
-                                    image = scaled_image;
-
-                                    thumbnail_width = scaled_w;
-                                    thumbnail_height = scaled_h;
-                                }
-                            }
-
-                            if (!scale_error)
-                            {
-                                int stride;
-                                const uint8_t* data = heif_image_get_plane_readonly(image, heif_channel_interleaved, &stride);
-
-                                final_hr = CreateDIBFromData(phbmp, pdwAlpha, data, thumbnail_width, thumbnail_height, stride);
-                            }
-
-                            heif_image_release(image);
-                        }
-
-                        heif_image_handle_release(image_handle);
-                    }
-
-                    heif_context_free(ctx);
+                    // replace image handle with thumbnail handle
+                    heif_image_handle_release(image_handle);
+                    image_handle = thumbnail_handle;
+                    is_thumbnail = true;
                 }
+            }
+        }
+
+        if (image_handle && 
+            !Sniff_IsWithinPixelLimit(heif_image_handle_get_width(image_handle), heif_image_handle_get_height(image_handle)))
+        {
+            Log_WriteFmt(LOG_WARNING, L"HEIF image too large: %i x %i", 
+                heif_image_handle_get_width(image_handle), heif_image_handle_get_height(image_handle));
+            Stats_Add(STAT_REJECTED_LIMITS);
+
+            heif_image_handle_release(image_handle);
+            image_handle = NULL;
+        }
+
+        if (image_handle)
+        {
+            Stats_Add(is_thumbnail ? STAT_SOURCE_THUMBNAIL : STAT_SOURCE_PRIMARY);
+
+            // keep high bit depth images (10 bit HLG/PQ etc) at 16 bits per channel until
+            // after scaling, then tone map only the output pixels
+            int bit_depth = heif_image_handle_get_luma_bits_per_pixel(image_handle);
+            TONEMAP* tonemap = NULL;
+            if (bit_depth > 8 && bit_depth <= 16)
+            {
+                LONG64 tonemap_start = Stats_Now();
+
+                // a 16 bit decode takes twice the memory of an 8 bit one, so very large
+                // images are reduced to 8 bits by libheif, still in their HDR encoding,
+                // and tone mapped from that
+                if ((UINT64)heif_image_handle_get_width(image_handle) * heif_image_handle_get_height(image_handle) > 
+                    HDR_MAX_FULL_DEPTH_PIXELS)
+                {
+                    bit_depth = 8;
+                }
+
+                struct heif_color_profile_nclx* nclx = NULL;
+                heif_image_handle_get_nclx_color_profile(image_handle, &nclx);
+
+                tonemap = ToneMap_Create(bit_depth, nclx);
+
+                heif_nclx_color_profile_free(nclx);
 
-                LocalFree(ptr);
+                Stats_AddTime(STAT_TIME_TONEMAP, tonemap_start);
             }
+
+            if (!tonemap)
+            {
+                bit_depth = 8;
+            }
+            else if (bit_depth > 8)
+            {
+                Stats_Add(STAT_HDR_DECODES);
+            }
+
+            Log_WriteFmt(LOG_DEBUG, L"decoding at bit depth: %i", bit_depth);
+
+            struct heif_decoding_options* decode_options = heif_decoding_options_alloc();
+            decode_options->convert_hdr_to_8bit = (bit_depth == 8);
+
+            LONG64 decode_start = Stats_Now();
+
+            struct heif_image* image = NULL;
+            err = heif_decode_image(image_handle, &image, heif_colorspace_RGB, 
+                (bit_depth == 8) ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RRGGBBAA_LE, 
+                decode_options);
+            heif_decoding_options_free(decode_options);
+            if (err.code) 
+            {
+                Log_WriteFmt(LOG_WARNING, L"Could not decode HEIF image: %S", err.message);
+                Stats_AddFailure(err.code);
+            }
+            else
+            {
+                Stats_AddTime(STAT_TIME_DECODE, decode_start);
+
+                int decoded_stride = 0;
+                heif_image_get_plane_readonly(image, heif_channel_interleaved, &decoded_stride);
+                LONG64 decoded_bytes = (LONG64)decoded_stride * heif_image_get_height(image, heif_channel_interleaved);
+                Stats_AddBytesInFlight(decoded_bytes);
+
+                Log_WriteFmt(LOG_DEBUG, L"HEIF image/thumb size: %i x %i", 
+                    heif_image_handle_get_width(image_handle), heif_image_handle_get_height(image_handle));
+
+                final_hr = CreateDIBFromImage(phbmp, pdwAlpha, image, requested_size, bit_depth, tonemap);
+
+                heif_image_release(image);
+                Stats_RemoveBytesInFlight(decoded_bytes);
+            }
+
+            LocalFree(tonemap);
+
+            heif_image_handle_release(image_handle);
         }
+
+        heif_context_free(ctx);
     }
 
+    // rejected files included
+    Log_WriteFmt(LOG_DEBUG, L"stream read: %I64u", sr.bytes_read);
+    Stats_Add(STAT_BYTES_READ, sr.bytes_read);
+
     //hr = CreateTestBitmap(cx, phbmp, pdwAlpha);
 
     if (FAILED(hr))
-        return hr;
+        final_hr = hr;
+
+    if (FAILED(final_hr))
+        Stats_Add(STAT_FAILED_REQUESTS);
+
+    Stats_AddTime(STAT_TIME_TOTAL, total_start);
 
     return final_hr;
 }
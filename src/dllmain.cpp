@@ -3,15 +3,31 @@
 #include <thumbcache.h> // For IThumbnailProvider.
 #include <shlobj.h>     // For SHChangeNotify
 #include <new>
+#include <limits.h>
 
 #include "log.h"
+#include "stats.h"
+#include "sniff.h"
 
 extern HRESULT CHEICThumbProvider_CreateInstance(REFIID riid, void** ppv);
+extern HRESULT CHEICPropertyStore_CreateInstance(REFIID riid, void** ppv);
 
 #define SZ_CLSID_HEICTHUMBHANDLER     L"{2c93d534-2a1f-40d2-a375-babc92996987}"
 #define SZ_HEICTHUMBHANDLER           L"HEIC Thumbnail Handler"
 
+#define SZ_CLSID_HEICPROPERTYHANDLER  L"{e3ce4afe-7866-40e3-96a2-93e4f7014534}"
+#define SZ_HEICPROPERTYHANDLER        L"HEIC Property Handler"
+
+// dav1d threads per AVIF decode, unless DecoderThreads is set
+const DWORD DEFAULT_DECODER_THREADS = 2;
+
+#define SZ_PROPERTYHANDLERS           L"Software\\Microsoft\\Windows\\CurrentVersion\\PropertySystem\\PropertyHandlers"
+
+// The property handler's CLSID is registered in HKLM as well, next to its associations
+#define SZ_MACHINEPROPERTYHANDLERCLSID L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICPROPERTYHANDLER
+
 const CLSID CLSID_HEICThumbHandler = { 0x2c93d534, 0x2a1f, 0x40d2, {0xa3, 0x75, 0xba, 0xbc, 0x92, 0x99, 0x69, 0x87} };
+const CLSID CLSID_HEICPropertyHandler = { 0xe3ce4afe, 0x7866, 0x40e3, {0x96, 0xa2, 0x93, 0xe4, 0xf7, 0x01, 0x45, 0x34} };
 
 typedef HRESULT(*PFNCREATEINSTANCE)(REFIID riid, void** ppvObject);
 struct CLASS_OBJECT_INIT
@@ -23,7 +39,8 @@ struct CLASS_OBJECT_INIT
 // add classes supported by this module here
 const CLASS_OBJECT_INIT c_rgClassObjectInit[] =
 {
-    { &CLSID_HEICThumbHandler, CHEICThumbProvider_CreateInstance }
+    { &CLSID_HEICThumbHandler, CHEICThumbProvider_CreateInstance },
+    { &CLSID_HEICPropertyHandler, CHEICPropertyStore_CreateInstance },
 };
 
 
@@ -32,6 +49,42 @@ long g_cRefModule = 0;
 // Handle the the DLL's module
 HINSTANCE g_hInst = NULL;
 
+// Reads an optional non-zero DWORD value, leaving *pdwValue unchanged otherwise
+void ReadOptionalDword(HKEY hk, PCWSTR pszValueName, DWORD* pdwValue)
+{
+    DWORD dwType = 0;
+    DWORD dwValue = 0;
+    DWORD dwSize = sizeof(DWORD);
+    HRESULT hr = HRESULT_FROM_WIN32(RegQueryValueEx(hk, pszValueName, 0, &dwType, (LPBYTE)&dwValue, &dwSize));
+    if (SUCCEEDED(hr) && dwType == REG_DWORD && dwValue != 0)
+    {
+        *pdwValue = dwValue;
+    }
+}
+
+// Exported from heif.dll by the dav1d-threads patch in vcpkg-overlay
+typedef void (*PFN_HEIF_DAV1D_SET_MAX_THREADS)(int n_threads);
+
+// Passes the thread budget to the patched dav1d decoder in libheif, which
+// reads it when each decoder is created. It is set through heif.dll rather
+// than the environment, which the host process (and anything it starts)
+// would share. The shell decodes several thumbnails at once, so each decode
+// only gets a few threads.
+void SetDecoderThreads(DWORD dwThreads)
+{
+    HMODULE hHeif = GetModuleHandleW(L"heif.dll");
+    PFN_HEIF_DAV1D_SET_MAX_THREADS pfnSetMaxThreads = hHeif ?
+        (PFN_HEIF_DAV1D_SET_MAX_THREADS)GetProcAddress(hHeif, "heif_dav1d_set_max_threads") : NULL;
+    if (pfnSetMaxThreads)
+    {
+        pfnSetMaxThreads((int)min(dwThreads, (DWORD)INT_MAX));
+    }
+    else
+    {
+        Log_WriteFmt(LOG_INFO, L"heif.dll is not patched for a dav1d thread budget, DecoderThreads is ignored");
+    }
+}
+
 // Standard DLL functions
 STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, void*)
 {
@@ -43,6 +96,7 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, void*)
         Log_Open(L"HEICThumbProvider");
 
         DWORD dwLevel = LOG_NONE;
+        DWORD dwDecoderThreads = DEFAULT_DECODER_THREADS;
 
         HKEY hk = 0;
         HRESULT hr = HRESULT_FROM_WIN32(RegOpenKeyEx(HKEY_CURRENT_USER, 
@@ -66,13 +120,30 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, void*)
                 }
             }
 
+            DWORD dwMaxItems = DEFAULT_MAX_ITEMS;
+            DWORD dwMaxTiles = DEFAULT_MAX_TILES;
+            DWORD dwMaxMegapixels = DEFAULT_MAX_MEGAPIXELS;
+            ReadOptionalDword(hk, L"MaxItems", &dwMaxItems);
+            ReadOptionalDword(hk, L"MaxTiles", &dwMaxTiles);
+            ReadOptionalDword(hk, L"MaxMegapixels", &dwMaxMegapixels);
+
+            HEIF_LIMITS limits = { dwMaxItems, dwMaxTiles, (UINT64)dwMaxMegapixels * 1000000 };
+            Sniff_SetLimits(&limits);
+
+            ReadOptionalDword(hk, L"DecoderThreads", &dwDecoderThreads);
+
             RegCloseKey(hk);
         }
 
         //Log_WriteFmt(LOG_NONE, L"LogLevel: %u", dwLevel);
+
+        SetDecoderThreads(dwDecoderThreads);
+
+        Stats_Open();
     }
     else if (dwReason == DLL_PROCESS_DETACH)
     {
+        Stats_Close();
         Log_Close();
     }
     return TRUE;
@@ -210,6 +281,95 @@ HRESULT CreateRegKeyAndSetValue(const REGISTRY_ENTRY* pRegistryEntry)
     return hr;
 }
 
+// Property handler associations under HKLM, one per extension
+const PCWSTR rgpszPropertyHandlerKeys[] =
+{
+    SZ_PROPERTYHANDLERS L"\\.heic",
+    SZ_PROPERTYHANDLERS L"\\.heif",
+    SZ_PROPERTYHANDLERS L"\\.hif",
+    SZ_PROPERTYHANDLERS L"\\.avif",
+};
+
+// Name of the value which keeps the handler we replaced, next to the association itself
+#define SZ_PREVIOUSPROPERTYHANDLER    L"HEICPreviousPropertyHandler"
+
+// Points an extension at our property handler. A handler which is already registered
+// for it by another application is saved so that it can be put
+// back on unregister; registering again doesn't overwrite the saved one with ours.
+HRESULT RegisterPropertyHandler(PCWSTR pszKeyName)
+{
+    HKEY hKey;
+    HRESULT hr = HRESULT_FROM_WIN32(RegCreateKeyExW(HKEY_LOCAL_MACHINE, pszKeyName,
+        0, NULL, REG_OPTION_NON_VOLATILE, KEY_QUERY_VALUE | KEY_SET_VALUE, NULL, &hKey, NULL));
+    if (SUCCEEDED(hr))
+    {
+        WCHAR szClsid[64] = {};
+        DWORD cbClsid = sizeof(szClsid);
+        HRESULT hrQuery = HRESULT_FROM_WIN32(RegGetValueW(hKey, NULL, NULL, RRF_RT_REG_SZ, NULL, szClsid, &cbClsid));
+        if (SUCCEEDED(hrQuery) && szClsid[0] && _wcsicmp(szClsid, SZ_CLSID_HEICPROPERTYHANDLER) != 0)
+        {
+            Log_WriteFmt(LOG_INFO, L"Replacing property handler %s, saved for unregister", szClsid);
+            hr = HRESULT_FROM_WIN32(RegSetValueExW(hKey, SZ_PREVIOUSPROPERTYHANDLER, 0, REG_SZ,
+                (LPBYTE)szClsid, ((DWORD)wcslen(szClsid) + 1) * sizeof(WCHAR)));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = HRESULT_FROM_WIN32(RegSetValueExW(hKey, NULL, 0, REG_SZ, (LPBYTE)SZ_CLSID_HEICPROPERTYHANDLER,
+                (DWORD)sizeof(SZ_CLSID_HEICPROPERTYHANDLER)));
+        }
+        RegCloseKey(hKey);
+    }
+    return hr;
+}
+
+// Restores the handler saved by RegisterPropertyHandler, or removes the association
+// if there was none. Associations which are no longer ours are left alone.
+HRESULT UnregisterPropertyHandler(PCWSTR pszKeyName)
+{
+    HKEY hKey;
+    HRESULT hr = HRESULT_FROM_WIN32(RegOpenKeyExW(HKEY_LOCAL_MACHINE, pszKeyName, 0, KEY_QUERY_VALUE | KEY_SET_VALUE, &hKey));
+    if (hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+    {
+        return S_OK;
+    }
+    if (SUCCEEDED(hr))
+    {
+        bool delete_key = false;
+
+        WCHAR szClsid[64] = {};
+        DWORD cbClsid = sizeof(szClsid);
+        HRESULT hrQuery = HRESULT_FROM_WIN32(RegGetValueW(hKey, NULL, NULL, RRF_RT_REG_SZ, NULL, szClsid, &cbClsid));
+        if (SUCCEEDED(hrQuery) && _wcsicmp(szClsid, SZ_CLSID_HEICPROPERTYHANDLER) == 0)
+        {
+            WCHAR szPrevious[64] = {};
+            DWORD cbPrevious = sizeof(szPrevious);
+            hrQuery = HRESULT_FROM_WIN32(RegGetValueW(hKey, NULL, SZ_PREVIOUSPROPERTYHANDLER, RRF_RT_REG_SZ, NULL, szPrevious, &cbPrevious));
+            if (SUCCEEDED(hrQuery) && szPrevious[0])
+            {
+                Log_WriteFmt(LOG_INFO, L"Restoring property handler %s", szPrevious);
+                hr = HRESULT_FROM_WIN32(RegSetValueExW(hKey, NULL, 0, REG_SZ,
+                    (LPBYTE)szPrevious, ((DWORD)wcslen(szPrevious) + 1) * sizeof(WCHAR)));
+                if (SUCCEEDED(hr))
+                {
+                    RegDeleteValueW(hKey, SZ_PREVIOUSPROPERTYHANDLER);
+                }
+            }
+            else
+            {
+                delete_key = true;
+            }
+        }
+        RegCloseKey(hKey);
+
+        if (delete_key)
+        {
+            hr = HRESULT_FROM_WIN32(RegDeleteTreeW(HKEY_LOCAL_MACHINE, pszKeyName));
+        }
+    }
+    return hr;
+}
+
 //
 // Registers this COM server
 //
@@ -233,6 +393,12 @@ STDAPI DllRegisterServer()
             {HKEY_CURRENT_USER,   L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICTHUMBHANDLER L"\\InProcServer32",             NULL,                           szModuleName},
             {HKEY_CURRENT_USER,   L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICTHUMBHANDLER L"\\InProcServer32",             L"ThreadingModel",              L"Apartment"},
             {HKEY_CURRENT_USER,   L"Software\\Classes\\.heic\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",            NULL,                           SZ_CLSID_HEICTHUMBHANDLER},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\.heif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",            NULL,                           SZ_CLSID_HEICTHUMBHANDLER},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\.hif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",             NULL,                           SZ_CLSID_HEICTHUMBHANDLER},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\.avif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",            NULL,                           SZ_CLSID_HEICTHUMBHANDLER},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICPROPERTYHANDLER,                              NULL,                           SZ_HEICPROPERTYHANDLER},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICPROPERTYHANDLER L"\\InProcServer32",          NULL,                           szModuleName},
+            {HKEY_CURRENT_USER,   L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICPROPERTYHANDLER L"\\InProcServer32",          L"ThreadingModel",              L"Both"},
         };
 
         hr = S_OK;
@@ -240,10 +406,46 @@ STDAPI DllRegisterServer()
         {
             hr = CreateRegKeyAndSetValue(&rgRegistryEntries[i]);
         }
+
+        if (SUCCEEDED(hr))
+        {
+            // The shell only reads property handler associations from HKLM, and creates the
+            // handler from the HKLM registration of its CLSID, so both require regsvr32 to be
+            // run elevated. Without it HKLM is left alone and the thumbnail handler still works.
+            const REGISTRY_ENTRY rgMachineEntries[] =
+            {
+                {HKEY_LOCAL_MACHINE,  SZ_MACHINEPROPERTYHANDLERCLSID,                                                      NULL,                           SZ_HEICPROPERTYHANDLER},
+                {HKEY_LOCAL_MACHINE,  SZ_MACHINEPROPERTYHANDLERCLSID L"\\InProcServer32",                                  NULL,                           szModuleName},
+                {HKEY_LOCAL_MACHINE,  SZ_MACHINEPROPERTYHANDLERCLSID L"\\InProcServer32",                                  L"ThreadingModel",              L"Both"},
+            };
+
+            HRESULT hrMachine = S_OK;
+            for (int i = 0; i < ARRAYSIZE(rgMachineEntries) && SUCCEEDED(hrMachine); i++)
+            {
+                hrMachine = CreateRegKeyAndSetValue(&rgMachineEntries[i]);
+            }
+
+            if (SUCCEEDED(hrMachine))
+            {
+                for (int i = 0; i < ARRAYSIZE(rgpszPropertyHandlerKeys); i++)
+                {
+                    hrMachine = RegisterPropertyHandler(rgpszPropertyHandlerKeys[i]);
+                    if (FAILED(hrMachine))
+                    {
+                        Log_WriteFmt(LOG_WARNING, L"Could not register property handler: 0x%08x", hrMachine);
+                    }
+                }
+            }
+            else
+            {
+                Log_WriteFmt(LOG_WARNING, L"Property handler not registered, needs elevation: 0x%08x", hrMachine);
+                RegDeleteTreeW(HKEY_LOCAL_MACHINE, SZ_MACHINEPROPERTYHANDLERCLSID);
+            }
+        }
     }
     if (SUCCEEDED(hr))
     {
-        // This tells the shell to invalidate the thumbnail cache.  This is important because any .heic files
+        // This tells the shell to invalidate the thumbnail cache.  This is important because any .heic (etc) files
         // viewed before registering this handler would otherwise show cached blank thumbnails.
         SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
     }
@@ -260,7 +462,11 @@ STDAPI DllUnregisterServer()
     const PCWSTR rgpszKeys[] =
     {
         L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICTHUMBHANDLER,
-        L"Software\\Classes\\.heic\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}"
+        L"Software\\Classes\\.heic\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",
+        L"Software\\Classes\\.heif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",
+        L"Software\\Classes\\.hif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",
+        L"Software\\Classes\\.avif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}",
+        L"Software\\Classes\\CLSID\\" SZ_CLSID_HEICPROPERTYHANDLER,
     };
 
     // Delete the registry entries
@@ -273,5 +479,28 @@ STDAPI DllUnregisterServer()
             hr = S_OK;
         }
     }
+
+    // Only remove the property handler association if it is still ours,
+    // and don't fail if it can't be removed without elevation
+    bool machine_unregistered = true;
+    for (int i = 0; i < ARRAYSIZE(rgpszPropertyHandlerKeys) && SUCCEEDED(hr); i++)
+    {
+        HRESULT hrMachine = UnregisterPropertyHandler(rgpszPropertyHandlerKeys[i]);
+        if (FAILED(hrMachine))
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not unregister property handler: 0x%08x", hrMachine);
+            machine_unregistered = false;
+        }
+    }
+
+    // The HKLM CLSID stays while any association may still point at it
+    if (SUCCEEDED(hr) && machine_unregistered)
+    {
+        HRESULT hrMachine = HRESULT_FROM_WIN32(RegDeleteTreeW(HKEY_LOCAL_MACHINE, SZ_MACHINEPROPERTYHANDLERCLSID));
+        if (FAILED(hrMachine) && hrMachine != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not unregister property handler CLSID: 0x%08x", hrMachine);
+        }
+    }
     return hr;
 }
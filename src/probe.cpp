@@ -0,0 +1,201 @@
+#include <windows.h>
+#include <stdio.h>
+
+#include <libheif/heif.h>
+
+#include "probe.h"
+#include "log.h"
+#include "stats.h"
+#include "sniff.h"
+#include "streamreader.h"
+
+// Minimal Exif (TIFF) parsing, just enough for the date taken
+
+const WORD EXIF_TAG_EXIF_IFD = 0x8769;
+const WORD EXIF_TAG_DATETIME_ORIGINAL = 0x9003;
+
+const UINT EXIF_ENTRY_SIZE = 12;
+const UINT EXIF_DATETIME_CCH = 19; // "YYYY:MM:DD HH:MM:SS"
+
+struct EXIF_DATA
+{
+    const BYTE* tiff;
+    UINT size;
+    bool big_endian;
+};
+
+WORD Exif_Get16(const EXIF_DATA* exif, const BYTE* p)
+{
+    return exif->big_endian ? (WORD)((p[0] << 8) | p[1]) : (WORD)((p[1] << 8) | p[0]);
+}
+
+DWORD Exif_Get32(const EXIF_DATA* exif, const BYTE* p)
+{
+    return exif->big_endian ? 
+        (((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3]) :
+        (((DWORD)p[3] << 24) | ((DWORD)p[2] << 16) | ((DWORD)p[1] << 8) | p[0]);
+}
+
+// Returns the 12 byte entry for tag in the IFD at ifd_offset, or NULL
+const BYTE* Exif_FindEntry(const EXIF_DATA* exif, DWORD ifd_offset, WORD tag)
+{
+    if (ifd_offset < 8 || ifd_offset > exif->size - 2)
+        return NULL;
+
+    UINT count = Exif_Get16(exif, &exif->tiff[ifd_offset]);
+    const BYTE* entry = &exif->tiff[ifd_offset + 2];
+    if (count > (exif->size - ifd_offset - 2) / EXIF_ENTRY_SIZE)
+        return NULL;
+
+    for (UINT i = 0; i < count; ++i, entry += EXIF_ENTRY_SIZE)
+    {
+        if (Exif_Get16(exif, entry) == tag)
+            return entry;
+    }
+    return NULL;
+}
+
+bool Exif_GetDateTime(const EXIF_DATA* exif, const BYTE* entry, FILETIME* pft)
+{
+    DWORD count = Exif_Get32(exif, &entry[4]);
+    DWORD offset = Exif_Get32(exif, &entry[8]);
+    if (count < EXIF_DATETIME_CCH || offset > exif->size || exif->size - offset < EXIF_DATETIME_CCH)
+        return false;
+
+    char buf[EXIF_DATETIME_CCH + 1] = {};
+    memcpy(buf, &exif->tiff[offset], EXIF_DATETIME_CCH);
+
+    SYSTEMTIME local = {};
+    if (sscanf_s(buf, "%4hu:%2hu:%2hu %2hu:%2hu:%2hu", 
+        &local.wYear, &local.wMonth, &local.wDay, &local.wHour, &local.wMinute, &local.wSecond) != 6)
+        return false;
+
+    // Exif times are local to wherever the photo was taken; like the system
+    // codecs, assume that is the current time zone
+    SYSTEMTIME utc = {};
+    return TzSpecificLocalTimeToSystemTime(NULL, &local, &utc) &&
+        SystemTimeToFileTime(&utc, pft);
+}
+
+void Exif_Parse(const BYTE* data, UINT size, HEIF_PROBE_INFO* pInfo)
+{
+    // HEIF Exif blocks start with a 32 bit big endian offset to the TIFF header
+    if (size < 4)
+        return;
+
+    DWORD header_offset = ((DWORD)data[0] << 24) | ((DWORD)data[1] << 16) | ((DWORD)data[2] << 8) | data[3];
+    if (header_offset > size - 4 || size - 4 - header_offset < 8)
+        return;
+
+    EXIF_DATA exif = {};
+    exif.tiff = &data[4 + header_offset];
+    exif.size = size - 4 - header_offset;
+
+    if (exif.tiff[0] == 'M' && exif.tiff[1] == 'M')
+        exif.big_endian = true;
+    else if (exif.tiff[0] != 'I' || exif.tiff[1] != 'I')
+        return;
+
+    DWORD ifd0 = Exif_Get32(&exif, &exif.tiff[4]);
+
+    const BYTE* entry = Exif_FindEntry(&exif, ifd0, EXIF_TAG_EXIF_IFD);
+    if (entry)
+    {
+        entry = Exif_FindEntry(&exif, Exif_Get32(&exif, &entry[8]), EXIF_TAG_DATETIME_ORIGINAL);
+    }
+    if (entry)
+    {
+        pInfo->has_date_taken = Exif_GetDateTime(&exif, entry, &pInfo->date_taken);
+    }
+}
+
+void Probe_ReadExif(heif_image_handle* image_handle, HEIF_PROBE_INFO* pInfo)
+{
+    heif_item_id exif_ID;
+    int nExif = heif_image_handle_get_list_of_metadata_block_IDs(image_handle, "Exif", &exif_ID, 1);
+    if (nExif < 1)
+        return;
+
+    size_t exif_size = heif_image_handle_get_metadata_size(image_handle, exif_ID);
+    if (exif_size == 0 || exif_size > PROBE_MAX_EXIF_BYTES)
+    {
+        Log_WriteFmt(LOG_DEBUG, L"skipping Exif block of %Iu bytes", exif_size);
+        return;
+    }
+
+    BYTE* exif_data = (BYTE*)LocalAlloc(LMEM_FIXED, exif_size);
+    if (exif_data)
+    {
+        heif_error err = heif_image_handle_get_metadata(image_handle, exif_ID, exif_data);
+        if (err.code)
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not read Exif: %S", err.message);
+        }
+        else
+        {
+            Exif_Parse(exif_data, (UINT)exif_size, pInfo);
+        }
+        LocalFree(exif_data);
+    }
+}
+
+HRESULT Probe_ReadStream(IStream* pStream, HEIF_PROBE_INFO* pInfo)
+{
+    ZeroMemory(pInfo, sizeof(*pInfo));
+
+    HEIF_STREAM_READER sr;
+    HRESULT hr = StreamReader_Init(&sr, pStream, PROBE_MAX_BYTES);
+    if (SUCCEEDED(hr))
+    {
+        // the meta box is read by libheif below, within PROBE_MAX_BYTES, so
+        // only the file type is sniffed and those bytes count towards the limit
+        ULONG cbSniffed = 0;
+        hr = Sniff_CheckFileType(pStream, &cbSniffed);
+        sr.bytes_read += cbSniffed;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = E_FAIL;
+
+        heif_context* ctx = heif_context_alloc();
+        heif_error err = heif_context_read_from_reader(ctx, StreamReader_GetReader(), &sr, nullptr);
+        if (err.code)
+        {
+            Log_WriteFmt(LOG_WARNING, L"Could not read HEIF file: %S", err.message);
+            Stats_AddFailure(err.code);
+        }
+        else
+        {
+            struct heif_image_handle* image_handle = NULL;
+            err = heif_context_get_primary_image_handle(ctx, &image_handle);
+            if (err.code)
+            {
+                Log_WriteFmt(LOG_WARNING, L"Could not read HEIF image: %S", err.message);
+                Stats_AddFailure(err.code);
+            }
+            else
+            {
+                pInfo->width = heif_image_handle_get_width(image_handle);
+                pInfo->height = heif_image_handle_get_height(image_handle);
+                pInfo->bit_depth = heif_image_handle_get_luma_bits_per_pixel(image_handle);
+                pInfo->has_alpha = heif_image_handle_has_alpha_channel(image_handle) != 0;
+                pInfo->thumbnail_count = heif_image_handle_get_number_of_thumbnails(image_handle);
+
+                Probe_ReadExif(image_handle, pInfo);
+
+                heif_image_handle_release(image_handle);
+                hr = S_OK;
+            }
+        }
+
+        heif_context_free(ctx);
+    }
+
+    pInfo->bytes_read = sr.bytes_read;
+
+    Log_WriteFmt(LOG_DEBUG, L"probe: 0x%08x, %i x %i, %i bits, %I64u bytes read", 
+        hr, pInfo->width, pInfo->height, pInfo->bit_depth, sr.bytes_read);
+
+    return hr;
+}
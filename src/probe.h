@@ -0,0 +1,30 @@
+#pragma once
+
+#include <objidl.h>
+
+// The most bytes a probe will read from a single file. This covers the
+// ftyp/meta boxes and Exif block of any reasonable image; files whose
+// metadata does not fit are reported as failures rather than read in full.
+const UINT64 PROBE_MAX_BYTES = 1024 * 1024;
+
+// Largest Exif block a probe will read.
+const UINT PROBE_MAX_EXIF_BYTES = 64 * 1024;
+
+struct HEIF_PROBE_INFO
+{
+    int width;              // primary image, as displayed (irot/imir applied)
+    int height;
+    int bit_depth;          // luma bits per pixel
+    bool has_alpha;
+    int thumbnail_count;
+
+    bool has_date_taken;
+    FILETIME date_taken;    // Exif DateTimeOriginal, converted to UTC
+
+    UINT64 bytes_read;
+};
+
+// Reads image metadata from the boxes of a HEIF stream without decoding any
+// image data or creating a decoder. Reads no more than PROBE_MAX_BYTES in
+// total, including the file type sniff.
+HRESULT Probe_ReadStream(IStream* pStream, HEIF_PROBE_INFO* pInfo);
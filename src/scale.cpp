@@ -0,0 +1,145 @@
+#include <windows.h>
+
+#include "scale.h"
+
+CRowScaler::CRowScaler() :
+    _src_width(0), _src_height(0), _dest_width(0), _dest_height(0),
+    _dest_data(NULL), _dest_stride(0),
+    _bit_depth(8), _tonemap(NULL),
+    _col_end(NULL), _sums(NULL),
+    _src_y(0), _dest_y(0), _row_end(0), _rows_summed(0)
+{
+}
+
+CRowScaler::~CRowScaler()
+{
+    LocalFree(_col_end);
+    LocalFree(_sums);
+}
+
+HRESULT CRowScaler::Init(int src_width, int src_height, int dest_width, int dest_height, BYTE* dest_data, UINT dest_stride,
+    int bit_depth, const TONEMAP* tonemap)
+{
+    if (_sums)
+        return E_UNEXPECTED;
+
+    if (dest_width <= 0 || dest_height <= 0 || dest_width > src_width || dest_height > src_height)
+        return E_INVALIDARG;
+
+    if (bit_depth < 8 || bit_depth > 16 || (bit_depth > 8 && !tonemap) || (tonemap && tonemap->bit_depth != bit_depth))
+        return E_INVALIDARG;
+
+    _col_end = (int*)LocalAlloc(LPTR, dest_width * sizeof(int));
+    _sums = (UINT64*)LocalAlloc(LPTR, dest_width * 4 * sizeof(UINT64));
+    if (!_col_end || !_sums)
+        return E_OUTOFMEMORY;
+
+    for (int x = 0; x < dest_width; ++x)
+    {
+        _col_end[x] = (int)((INT64)(x + 1) * src_width / dest_width);
+    }
+
+    _src_width = src_width;
+    _src_height = src_height;
+    _dest_width = dest_width;
+    _dest_height = dest_height;
+    _dest_data = dest_data;
+    _dest_stride = dest_stride;
+    _bit_depth = bit_depth;
+    _tonemap = tonemap;
+
+    _src_y = 0;
+    _dest_y = 0;
+    _row_end = (int)((INT64)src_height / dest_height);
+    _rows_summed = 0;
+
+    return S_OK;
+}
+
+void CRowScaler::PushRow(const void* src_row)
+{
+    if (_src_y >= _src_height)
+        return;
+
+    if (_bit_depth > 8)
+    {
+        SumRow(static_cast<const uint16_t*>(src_row));
+    }
+    else
+    {
+        SumRow(static_cast<const uint8_t*>(src_row));
+    }
+
+    ++_rows_summed;
+    ++_src_y;
+
+    if (_src_y == _row_end)
+    {
+        EmitRow();
+    }
+}
+
+template <typename T>
+void CRowScaler::SumRow(const T* src_row)
+{
+    UINT64* sum = _sums;
+    int x = 0;
+    for (int dx = 0; dx < _dest_width; ++dx)
+    {
+        for (int col_end = _col_end[dx]; x < col_end; ++x)
+        {
+            const T* px = &src_row[x * 4];
+            sum[0] += px[0];
+            sum[1] += px[1];
+            sum[2] += px[2];
+            sum[3] += px[3];
+        }
+        sum += 4;
+    }
+}
+
+void CRowScaler::EmitRow()
+{
+    BYTE* dest_row = &_dest_data[(SIZE_T)_dest_y * _dest_stride];
+
+    UINT64* sum = _sums;
+    int col_begin = 0;
+    for (int dx = 0; dx < _dest_width; ++dx)
+    {
+        UINT64 count = (UINT64)(_col_end[dx] - col_begin) * _rows_summed;
+        UINT64 half = count / 2;
+
+        UINT64 r = (sum[0] + half) / count;
+        UINT64 g = (sum[1] + half) / count;
+        UINT64 b = (sum[2] + half) / count;
+        UINT64 a = (sum[3] + half) / count;
+
+        if (_tonemap)
+        {
+            BYTE rgb[3];
+            ToneMap_Apply(_tonemap, (UINT)r, (UINT)g, (UINT)b, rgb);
+            r = rgb[0];
+            g = rgb[1];
+            b = rgb[2];
+
+            UINT64 max_value = (1u << _bit_depth) - 1;
+            a = (a * 255 + max_value / 2) / max_value;
+        }
+
+        // RGBA in, BGRA out
+        dest_row[0] = (BYTE)b;
+        dest_row[1] = (BYTE)g;
+        dest_row[2] = (BYTE)r;
+        dest_row[3] = (BYTE)min(a, 255);
+
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+
+        col_begin = _col_end[dx];
+        sum += 4;
+        dest_row += 4;
+    }
+
+    _rows_summed = 0;
+    ++_dest_y;
+    _row_end = (int)((INT64)(_dest_y + 1) * _src_height / _dest_height);
+}
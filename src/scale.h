@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "tonemap.h"
+
+// Incremental area-averaging downscaler.
+//
+// Source rows are pushed top to bottom. Only a single row of per-channel sums
+// (the width of the output) is kept, and each output row is written to the
+// destination as soon as its last contributing source row has been pushed,
+// so the source never needs to be held in memory as a whole.
+//
+// High bit depth sources are averaged at full precision and only reduced to
+// 8 bits per channel on output, through a TONEMAP.
+
+class CRowScaler
+{
+public:
+    CRowScaler();
+    ~CRowScaler();
+
+    // dest_data receives 32bpp BGRA rows, dest_width x dest_height,
+    // which must not be larger than the source in either dimension.
+    // tonemap converts the averaged samples to 8 bit sRGB and must be for bit_depth.
+    // It is required for bit_depth > 8 and optional at 8 bits.
+    HRESULT Init(int src_width, int src_height, int dest_width, int dest_height, BYTE* dest_data, UINT dest_stride,
+        int bit_depth = 8, const TONEMAP* tonemap = NULL);
+
+    // src_row is src_width pixels of interleaved RGBA, 8 bits per channel,
+    // or 16 bit little endian samples when bit_depth > 8
+    void PushRow(const void* src_row);
+
+    bool IsComplete() const { return _dest_y == _dest_height; }
+
+private:
+    template <typename T> void SumRow(const T* src_row);
+    void EmitRow();
+
+    int _src_width;
+    int _src_height;
+    int _dest_width;
+    int _dest_height;
+
+    BYTE* _dest_data;
+    UINT _dest_stride;
+
+    int _bit_depth;
+    const TONEMAP* _tonemap;
+
+    int* _col_end;      // one past the last source column of each output column
+    UINT64* _sums;      // RGBA sums for the output row being accumulated
+
+    int _src_y;         // next source row expected
+    int _dest_y;        // output row being accumulated
+    int _row_end;       // one past the last source row of _dest_y
+    int _rows_summed;
+};
@@ -0,0 +1,386 @@
+#include <windows.h>
+#include <shlwapi.h>
+
+#include <libheif/heif.h>
+
+#include "sniff.h"
+#include "log.h"
+#include "stats.h"
+
+#define BOX_TYPE(a, b, c, d) (((DWORD)(a) << 24) | ((DWORD)(b) << 16) | ((DWORD)(c) << 8) | (DWORD)(d))
+
+const DWORD BOX_META = BOX_TYPE('m', 'e', 't', 'a');
+const DWORD BOX_IINF = BOX_TYPE('i', 'i', 'n', 'f');
+const DWORD BOX_IREF = BOX_TYPE('i', 'r', 'e', 'f');
+const DWORD BOX_IPRP = BOX_TYPE('i', 'p', 'r', 'p');
+const DWORD BOX_IPCO = BOX_TYPE('i', 'p', 'c', 'o');
+const DWORD BOX_ISPE = BOX_TYPE('i', 's', 'p', 'e');
+const DWORD BOX_DIMG = BOX_TYPE('d', 'i', 'm', 'g');
+const DWORD BOX_FTYP = BOX_TYPE('f', 't', 'y', 'p');
+
+// Brands we can decode, accepted as either the major or a compatible brand.
+// libheif 1.12's heif_check_filetype only reports a heic major brand as
+// supported, and rejects major brands it doesn't know such as miaf.
+const DWORD supported_brands[] =
+{
+    BOX_TYPE('h', 'e', 'i', 'c'),
+    BOX_TYPE('h', 'e', 'i', 'x'),
+    BOX_TYPE('h', 'e', 'i', 'm'),
+    BOX_TYPE('h', 'e', 'i', 's'),
+    BOX_TYPE('a', 'v', 'i', 'f'),
+    BOX_TYPE('m', 'i', 'f', '1'),
+};
+
+const UINT FULL_BOX_HEADER = 4; // version and flags
+
+HEIF_LIMITS current_limits = 
+{
+    DEFAULT_MAX_ITEMS,
+    DEFAULT_MAX_TILES,
+    (UINT64)DEFAULT_MAX_MEGAPIXELS * 1000000,
+};
+
+void Sniff_SetLimits(const HEIF_LIMITS* pLimits)
+{
+    current_limits = *pLimits;
+}
+
+const HEIF_LIMITS* Sniff_GetLimits()
+{
+    return &current_limits;
+}
+
+bool Sniff_IsWithinPixelLimit(int width, int height)
+{
+    return width > 0 && height > 0 && (UINT64)width * (UINT64)height <= current_limits.max_pixels;
+}
+
+WORD Sniff_Get16(const BYTE* p)
+{
+    return (WORD)((p[0] << 8) | p[1]);
+}
+
+DWORD Sniff_Get32(const BYTE* p)
+{
+    return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3];
+}
+
+UINT64 Sniff_Get64(const BYTE* p)
+{
+    return ((UINT64)Sniff_Get32(p) << 32) | Sniff_Get32(&p[4]);
+}
+
+struct BOX_HEADER
+{
+    DWORD type;
+    UINT64 size;        // including the header
+    UINT header_size;
+};
+
+// Parses the header of a box starting at data, with header_avail bytes readable
+// and container_remaining bytes up to the end of the enclosing container (or file).
+// Returns false if the header is malformed; the caller checks the box fits.
+bool Sniff_ParseBoxHeader(const BYTE* data, UINT64 header_avail, UINT64 container_remaining, BOX_HEADER* box)
+{
+    if (header_avail < 8)
+        return false;
+
+    box->size = Sniff_Get32(data);
+    box->type = Sniff_Get32(&data[4]);
+    box->header_size = 8;
+
+    if (box->size == 1)
+    {
+        if (header_avail < 16)
+            return false;
+
+        box->size = Sniff_Get64(&data[8]);
+        box->header_size = 16;
+    }
+    else if (box->size == 0)
+    {
+        // extends to the end of the container
+        box->size = container_remaining;
+    }
+
+    return box->size >= box->header_size;
+}
+
+struct SNIFF_INFO
+{
+    UINT64 items;
+    UINT64 max_tiles;
+    UINT64 max_pixels;
+};
+
+bool Sniff_ScanBoxes(const BYTE* data, UINT64 size, SNIFF_INFO* info, int depth)
+{
+    if (depth > 2)
+        return true;
+
+    UINT64 offset = 0;
+    while (offset < size)
+    {
+        BOX_HEADER box;
+        if (!Sniff_ParseBoxHeader(&data[offset], size - offset, size - offset, &box) || box.size > size - offset)
+            return false;
+
+        const BYTE* payload = &data[offset + box.header_size];
+        UINT64 payload_size = box.size - box.header_size;
+
+        if (box.type == BOX_IINF)
+        {
+            if (payload_size < FULL_BOX_HEADER + ((payload_size > 0 && payload[0] == 0) ? 2 : 4))
+                return false;
+
+            info->items = (payload[0] == 0) ? Sniff_Get16(&payload[FULL_BOX_HEADER]) : Sniff_Get32(&payload[FULL_BOX_HEADER]);
+        }
+        else if (box.type == BOX_IREF)
+        {
+            if (payload_size < FULL_BOX_HEADER)
+                return false;
+
+            UINT id_size = (payload[0] == 0) ? 2 : 4;
+
+            UINT64 ref_offset = FULL_BOX_HEADER;
+            while (ref_offset < payload_size)
+            {
+                BOX_HEADER ref;
+                UINT64 ref_remaining = payload_size - ref_offset;
+                if (!Sniff_ParseBoxHeader(&payload[ref_offset], ref_remaining, ref_remaining, &ref) || ref.size > ref_remaining)
+                    return false;
+
+                if (ref.type == BOX_DIMG)
+                {
+                    if (ref.size < ref.header_size + id_size + 2)
+                        return false;
+
+                    WORD count = Sniff_Get16(&payload[ref_offset + ref.header_size + id_size]);
+                    info->max_tiles = max(info->max_tiles, count);
+                }
+
+                ref_offset += ref.size;
+            }
+        }
+        else if (box.type == BOX_IPRP || box.type == BOX_IPCO)
+        {
+            if (!Sniff_ScanBoxes(payload, payload_size, info, depth + 1))
+                return false;
+        }
+        else if (box.type == BOX_ISPE)
+        {
+            if (payload_size < FULL_BOX_HEADER + 8)
+                return false;
+
+            UINT64 pixels = (UINT64)Sniff_Get32(&payload[FULL_BOX_HEADER]) * Sniff_Get32(&payload[FULL_BOX_HEADER + 4]);
+            info->max_pixels = max(info->max_pixels, pixels);
+        }
+
+        offset += box.size;
+    }
+
+    return true;
+}
+
+bool Sniff_IsSupportedBrand(DWORD brand)
+{
+    for (UINT i = 0; i < ARRAYSIZE(supported_brands); ++i)
+    {
+        if (brand == supported_brands[i])
+            return true;
+    }
+    return false;
+}
+
+// Checks the major and compatible brands of the ftyp box at the start of data
+bool Sniff_HasSupportedBrand(const BYTE* data, UINT size)
+{
+    BOX_HEADER box;
+    if (size < 16 || !Sniff_ParseBoxHeader(data, size, size, &box) || box.type != BOX_FTYP || box.size < 16)
+        return false;
+
+    if (Sniff_IsSupportedBrand(Sniff_Get32(&data[8])))
+        return true;
+
+    // minor_version at 12, then compatible brands to the end of the box
+    UINT64 end = min(box.size, (UINT64)size);
+    for (UINT64 offset = 16; offset + 4 <= end; offset += 4)
+    {
+        if (Sniff_IsSupportedBrand(Sniff_Get32(&data[offset])))
+            return true;
+    }
+    return false;
+}
+
+HRESULT Sniff_ReadAt(IStream* pStream, UINT64 offset, void* buf, ULONG cb, ULONG* pcbRead)
+{
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)offset;
+    HRESULT hr = pStream->Seek(li, STREAM_SEEK_SET, NULL);
+    if (SUCCEEDED(hr))
+    {
+        *pcbRead = 0;
+        hr = pStream->Read(buf, cb, pcbRead);
+    }
+    return hr;
+}
+
+// Finds the meta box and scans it. Files which end, or are truncated, before
+// a meta box are left for libheif to reject; files with more top level boxes
+// than SNIFF_MAX_TOP_LEVEL_BOXES in front of it are rejected here. Adds the
+// number of bytes read to *pcbRead.
+HRESULT Sniff_CheckMeta(IStream* pStream, UINT64 stream_size, ULONG* pcbRead)
+{
+    const HRESULT hrInvalid = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+    UINT64 offset = 0;
+    UINT i = 0;
+    for (; i < SNIFF_MAX_TOP_LEVEL_BOXES && offset < stream_size; ++i)
+    {
+        BYTE header[16];
+        ULONG cbRead = 0;
+        HRESULT hr = Sniff_ReadAt(pStream, offset, header, sizeof(header), &cbRead);
+        if (FAILED(hr))
+            return hr;
+
+        *pcbRead += cbRead;
+
+        UINT64 remaining = stream_size - offset;
+
+        BOX_HEADER box;
+        if (!Sniff_ParseBoxHeader(header, min((UINT64)cbRead, remaining), remaining, &box))
+            return hrInvalid;
+
+        if (box.type != BOX_META)
+        {
+            // truncated files are only a problem if the part we need is missing
+            if (box.size > remaining)
+                break;
+
+            offset += box.size;
+            continue;
+        }
+
+        if (box.size > remaining)
+        {
+            Log_WriteFmt(LOG_WARNING, L"meta box truncated");
+            return hrInvalid;
+        }
+
+        if (box.size > SNIFF_MAX_META_BYTES)
+        {
+            Log_WriteFmt(LOG_WARNING, L"meta box too large: %I64u bytes", box.size);
+            return hrInvalid;
+        }
+
+        ULONG payload_size = (ULONG)(box.size - box.header_size);
+        BYTE* payload = (BYTE*)LocalAlloc(LMEM_FIXED, max(payload_size, 1));
+        if (!payload)
+            return E_OUTOFMEMORY;
+
+        hr = Sniff_ReadAt(pStream, offset + box.header_size, payload, payload_size, &cbRead);
+        if (SUCCEEDED(hr))
+        {
+            *pcbRead += cbRead;
+
+            SNIFF_INFO info = {};
+            if (cbRead != payload_size || payload_size < FULL_BOX_HEADER ||
+                !Sniff_ScanBoxes(&payload[FULL_BOX_HEADER], payload_size - FULL_BOX_HEADER, &info, 0))
+            {
+                Log_WriteFmt(LOG_WARNING, L"meta box malformed");
+                hr = hrInvalid;
+            }
+            else
+            {
+                Log_WriteFmt(LOG_DEBUG, L"sniff: %I64u items, %I64u tiles, %I64u pixels", info.items, info.max_tiles, info.max_pixels);
+
+                if (info.items > current_limits.max_items ||
+                    info.max_tiles > current_limits.max_tiles ||
+                    info.max_pixels > current_limits.max_pixels)
+                {
+                    Log_WriteFmt(LOG_WARNING, L"file exceeds limits: %I64u items, %I64u tiles, %I64u pixels", info.items, info.max_tiles, info.max_pixels);
+                    hr = hrInvalid;
+                }
+            }
+        }
+
+        LocalFree(payload);
+        return hr;
+    }
+
+    if (i == SNIFF_MAX_TOP_LEVEL_BOXES && offset < stream_size)
+    {
+        Log_WriteFmt(LOG_WARNING, L"no meta box in the first %u top level boxes", SNIFF_MAX_TOP_LEVEL_BOXES);
+        return hrInvalid;
+    }
+
+    return S_OK;
+}
+
+// Checks the ftyp box in the first SNIFF_BYTES of the stream
+HRESULT Sniff_ReadFileType(IStream* pStream, ULONG* pcbRead)
+{
+    BYTE buf[SNIFF_BYTES];
+    ULONG cbRead = 0;
+    HRESULT hr = Sniff_ReadAt(pStream, 0, buf, sizeof(buf), &cbRead);
+    if (SUCCEEDED(hr))
+    {
+        *pcbRead = cbRead;
+
+        // Given only the first box header, heif_check_filetype just checks for ftyp;
+        // its verdict on the brands is too strict, so those are checked here
+        bool has_ftyp = cbRead >= 8 && heif_check_filetype(buf, 8) != heif_filetype_no;
+        if (!has_ftyp || !Sniff_HasSupportedBrand(buf, cbRead))
+        {
+            Log_WriteFmt(LOG_WARNING, L"not a supported HEIF file");
+            hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+            Stats_Add(STAT_REJECTED_FILETYPE);
+        }
+    }
+    return hr;
+}
+
+HRESULT Sniff_CheckFileType(IStream* pStream, ULONG* pcbRead)
+{
+    LONG64 sniff_start = Stats_Now();
+
+    *pcbRead = 0;
+    HRESULT hr = Sniff_ReadFileType(pStream, pcbRead);
+
+    Stats_AddTime(STAT_TIME_SNIFF, sniff_start);
+
+    HRESULT hrReset = IStream_Reset(pStream);
+    if (SUCCEEDED(hr))
+    {
+        hr = hrReset;
+    }
+
+    return hr;
+}
+
+HRESULT Sniff_CheckStream(IStream* pStream, UINT64 stream_size, ULONG* pcbRead)
+{
+    LONG64 sniff_start = Stats_Now();
+
+    *pcbRead = 0;
+    HRESULT hr = Sniff_ReadFileType(pStream, pcbRead);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = Sniff_CheckMeta(pStream, stream_size, pcbRead);
+        if (hr == HRESULT_FROM_WIN32(ERROR_INVALID_DATA))
+        {
+            Stats_Add(STAT_REJECTED_LIMITS);
+        }
+    }
+
+    Stats_AddTime(STAT_TIME_SNIFF, sniff_start);
+
+    HRESULT hrReset = IStream_Reset(pStream);
+    if (SUCCEEDED(hr))
+    {
+        hr = hrReset;
+    }
+
+    return hr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <objidl.h>
+
+// Cheap checks made before a file is read in full or handed to libheif.
+//
+// Only the first SNIFF_BYTES are read to check the ftyp brands, then the
+// top level box headers are walked (with seeks) to find the meta box, which
+// is scanned for the number of items, grid tiles and the largest declared
+// image size. Anything over the limits is rejected without further I/O.
+
+const UINT SNIFF_BYTES = 512;
+
+// Largest meta box that will be scanned; larger ones are rejected
+const UINT SNIFF_MAX_META_BYTES = 4 * 1024 * 1024;
+
+// Most top level boxes that will be walked looking for meta
+const UINT SNIFF_MAX_TOP_LEVEL_BOXES = 32;
+
+struct HEIF_LIMITS
+{
+    DWORD max_items;        // entries in iinf
+    DWORD max_tiles;        // dimg references of any one derived image
+    UINT64 max_pixels;      // width x height of any ispe or image handle
+};
+
+const DWORD DEFAULT_MAX_ITEMS = 4096;
+const DWORD DEFAULT_MAX_TILES = 2048;
+const DWORD DEFAULT_MAX_MEGAPIXELS = 256;
+
+void Sniff_SetLimits(const HEIF_LIMITS* pLimits);
+const HEIF_LIMITS* Sniff_GetLimits();
+
+// Returns S_OK if the stream looks like a HEIF file within the limits,
+// HRESULT_FROM_WIN32(ERROR_BAD_FORMAT) if it is not a supported HEIF file, or
+// HRESULT_FROM_WIN32(ERROR_INVALID_DATA) if it is malformed or over the limits.
+// Returns the number of bytes read in *pcbRead, rejected or not. The stream is
+// left positioned at the start.
+HRESULT Sniff_CheckStream(IStream* pStream, UINT64 stream_size, ULONG* pcbRead);
+
+// Only the ftyp check of Sniff_CheckStream, for callers which bound their own
+// reads and don't need the meta box scanned twice. Returns the number of bytes
+// read in *pcbRead, and HRESULT_FROM_WIN32(ERROR_BAD_FORMAT) if it is not a
+// supported HEIF file. The stream is left positioned at the start.
+HRESULT Sniff_CheckFileType(IStream* pStream, ULONG* pcbRead);
+
+// Checks a declared image size against max_pixels
+bool Sniff_IsWithinPixelLimit(int width, int height);
@@ -0,0 +1,137 @@
+#include <windows.h>
+
+#include "stats.h"
+#include "log.h"
+
+HANDLE hStatsMapping = NULL;
+STATS_BLOCK* pStats = NULL;
+
+LONG64 qpc_frequency = 0;
+
+void Stats_Open()
+{
+    if (pStats)
+        return;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    qpc_frequency = freq.QuadPart;
+
+    hStatsMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(STATS_BLOCK), SZ_STATS_MAPPING_NAME);
+    if (!hStatsMapping)
+    {
+        Log_WriteFmt(LOG_WARNING, L"Could not create stats mapping: 0x%08x", GetLastError());
+        return;
+    }
+
+    STATS_BLOCK* block = (STATS_BLOCK*)MapViewOfFile(hStatsMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(STATS_BLOCK));
+    if (!block)
+    {
+        Log_WriteFmt(LOG_WARNING, L"Could not map stats: 0x%08x", GetLastError());
+        Stats_Close();
+        return;
+    }
+
+    // a new mapping is zeroed; an existing one may belong to another version of the handler
+    if (block->version != 0 && (block->version != STATS_VERSION || block->slot_count != STATS_SLOT_COUNT))
+    {
+        Log_WriteFmt(LOG_WARNING, L"Stats block version mismatch: %u", block->version);
+        UnmapViewOfFile(block);
+        Stats_Close();
+        return;
+    }
+
+    block->slot_count = STATS_SLOT_COUNT;
+    block->version = STATS_VERSION;
+
+    pStats = block;
+}
+
+void Stats_Close()
+{
+    if (pStats)
+    {
+        UnmapViewOfFile(pStats);
+        pStats = NULL;
+    }
+
+    if (hStatsMapping)
+    {
+        CloseHandle(hStatsMapping);
+        hStatsMapping = NULL;
+    }
+}
+
+// Thread ids are multiples of 4, so the low bits are dropped
+// before picking a slot, otherwise only every 4th slot is used
+STATS_SLOT* Stats_GetSlot()
+{
+    return &pStats->slots[(GetCurrentThreadId() >> 2) % STATS_SLOT_COUNT];
+}
+
+void Stats_Add(STATS_COUNTER counter, LONG64 value)
+{
+    if (!pStats)
+        return;
+
+    InterlockedExchangeAddNoFence64(&Stats_GetSlot()->counters[counter], value);
+}
+
+void Stats_AddFailure(int heif_error_code)
+{
+    if (!pStats)
+        return;
+
+    UINT bucket = min((UINT)heif_error_code, STATS_ERROR_CODES - 1);
+    InterlockedExchangeAddNoFence64(&Stats_GetSlot()->failures[bucket], 1);
+}
+
+LONG64 Stats_Now()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void Stats_AddTime(STATS_TIMER timer, LONG64 start)
+{
+    if (!pStats)
+        return;
+
+    LONG64 elapsed_us = (Stats_Now() - start) * 1000000 / qpc_frequency;
+
+    UINT bucket = 0;
+    for (ULONG64 t = (ULONG64)elapsed_us; t && bucket < STATS_TIME_BUCKETS - 1; t >>= 1)
+    {
+        ++bucket;
+    }
+
+    STATS_SLOT* slot = Stats_GetSlot();
+    InterlockedExchangeAddNoFence64(&slot->time_total_us[timer], elapsed_us);
+    InterlockedExchangeAddNoFence64(&slot->time_buckets[timer][bucket], 1);
+}
+
+void Stats_AddBytesInFlight(LONG64 bytes)
+{
+    if (!pStats)
+        return;
+
+    LONG64 in_flight = InterlockedExchangeAddNoFence64(&pStats->bytes_in_flight, bytes) + bytes;
+
+    LONG64 peak = pStats->peak_bytes_in_flight;
+    while (in_flight > peak)
+    {
+        LONG64 prev = InterlockedCompareExchangeNoFence64(&pStats->peak_bytes_in_flight, in_flight, peak);
+        if (prev == peak)
+            break;
+        peak = prev;
+    }
+}
+
+void Stats_RemoveBytesInFlight(LONG64 bytes)
+{
+    if (!pStats)
+        return;
+
+    InterlockedExchangeAddNoFence64(&pStats->bytes_in_flight, -bytes);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// Always-on performance counters, kept in a named shared memory block so they
+// can be read from outside the (often short lived, isolated) host process by
+// HEICStats.exe. Every process loading the handler in the session maps the same
+// block, so the numbers are totals across all of them.
+//
+// Updating a counter is a single relaxed interlocked add into a cache line
+// padded slot chosen by thread id, so threads don't contend with each other.
+// A reader sums the slots.
+
+#define SZ_STATS_MAPPING_NAME   L"Local\\HEICThumbnailHandlerStats"
+
+const DWORD STATS_VERSION = 2;
+
+const UINT STATS_SLOT_COUNT = 64;
+
+// Histogram bucket i counts durations of [2^(i-1), 2^i) microseconds,
+// bucket 0 anything under 1us, the last bucket anything longer.
+const UINT STATS_TIME_BUCKETS = 24;
+
+// Failures by heif_error_code, codes past the end are counted in the last bucket
+const UINT STATS_ERROR_CODES = 16;
+
+enum STATS_COUNTER
+{
+    STAT_THUMBNAIL_REQUESTS,
+    STAT_PROPERTY_REQUESTS,
+    STAT_SOURCE_THUMBNAIL,      // decoded from an embedded thumbnail
+    STAT_SOURCE_PRIMARY,        // decoded from the primary image
+    STAT_HDR_DECODES,           // decoded at more than 8 bits and tone mapped
+    STAT_BYTES_READ,
+    STAT_FAILED_REQUESTS,
+    STAT_REJECTED_FILETYPE,     // failed the ftyp brand check
+    STAT_REJECTED_LIMITS,       // malformed, or over the item/tile/pixel limits
+
+    STAT_COUNTER_MAX,
+};
+
+enum STATS_TIMER
+{
+    STAT_TIME_TOTAL,            // GetThumbnail, start to finish
+    STAT_TIME_READ,             // parsing the file boxes
+    STAT_TIME_DECODE,           // heif_decode_image, including color conversion to RGB
+    STAT_TIME_TONEMAP,          // building the tone map table
+    STAT_TIME_SCALE,            // scaling and BGRA conversion into the DIB
+    STAT_TIME_PROBE,            // property handler metadata probe
+    STAT_TIME_SNIFF,            // file type and limit checks
+
+    STAT_TIMER_MAX,
+};
+
+struct __declspec(align(64)) STATS_SLOT
+{
+    LONG64 counters[STAT_COUNTER_MAX];
+    LONG64 failures[STATS_ERROR_CODES];
+    LONG64 time_total_us[STAT_TIMER_MAX];
+    LONG64 time_buckets[STAT_TIMER_MAX][STATS_TIME_BUCKETS];
+};
+
+struct STATS_BLOCK
+{
+    DWORD version;
+    DWORD slot_count;
+
+    // not per slot, the peak needs the exact current total
+    __declspec(align(64)) LONG64 bytes_in_flight;
+    LONG64 peak_bytes_in_flight;
+
+    STATS_SLOT slots[STATS_SLOT_COUNT];
+};
+
+void Stats_Open();
+void Stats_Close();
+
+void Stats_Add(STATS_COUNTER counter, LONG64 value = 1);
+void Stats_AddFailure(int heif_error_code);
+
+// Returns a start time for Stats_AddTime
+LONG64 Stats_Now();
+void Stats_AddTime(STATS_TIMER timer, LONG64 start);
+
+// Memory held by a request's decoded image, tracked for the peak
+void Stats_AddBytesInFlight(LONG64 bytes);
+void Stats_RemoveBytesInFlight(LONG64 bytes);
@@ -0,0 +1,81 @@
+#include <windows.h>
+#include <shlwapi.h>
+
+#include "streamreader.h"
+#include "log.h"
+
+static int64_t StreamReader_GetPosition(void* userdata)
+{
+    HEIF_STREAM_READER* sr = (HEIF_STREAM_READER*)userdata;
+    return (int64_t)sr->position;
+}
+
+static int StreamReader_Read(void* data, size_t size, void* userdata)
+{
+    HEIF_STREAM_READER* sr = (HEIF_STREAM_READER*)userdata;
+
+    if (size > MAXDWORD || size > sr->max_bytes || sr->bytes_read + size > sr->max_bytes)
+    {
+        Log_WriteFmt(LOG_WARNING, L"stream read limit reached: %I64u + %Iu bytes", sr->bytes_read, size);
+        return 1;
+    }
+
+    ULONG ulRead = 0;
+    HRESULT hr = sr->pStream->Read(data, (ULONG)size, &ulRead);
+    if (FAILED(hr) || ulRead != size)
+        return 1;
+
+    sr->position += size;
+    sr->bytes_read += size;
+    return 0;
+}
+
+static int StreamReader_Seek(int64_t position, void* userdata)
+{
+    HEIF_STREAM_READER* sr = (HEIF_STREAM_READER*)userdata;
+
+    LARGE_INTEGER li;
+    li.QuadPart = position;
+    HRESULT hr = sr->pStream->Seek(li, STREAM_SEEK_SET, NULL);
+    if (FAILED(hr))
+        return 1;
+
+    sr->position = (UINT64)position;
+    return 0;
+}
+
+static heif_reader_grow_status StreamReader_WaitForFileSize(int64_t target_size, void* userdata)
+{
+    HEIF_STREAM_READER* sr = (HEIF_STREAM_READER*)userdata;
+    return ((UINT64)target_size > sr->size) ? heif_reader_grow_status_size_beyond_eof : heif_reader_grow_status_size_reached;
+}
+
+static const heif_reader stream_reader =
+{
+    1,
+    StreamReader_GetPosition,
+    StreamReader_Read,
+    StreamReader_Seek,
+    StreamReader_WaitForFileSize,
+};
+
+HRESULT StreamReader_Init(HEIF_STREAM_READER* pReader, IStream* pStream, UINT64 max_bytes)
+{
+    ZeroMemory(pReader, sizeof(*pReader));
+    pReader->pStream = pStream;
+    pReader->max_bytes = max_bytes;
+
+    ULARGE_INTEGER ulSize;
+    HRESULT hr = IStream_Size(pStream, &ulSize);
+    if (SUCCEEDED(hr))
+    {
+        pReader->size = ulSize.QuadPart;
+        hr = IStream_Reset(pStream);
+    }
+    return hr;
+}
+
+const heif_reader* StreamReader_GetReader()
+{
+    return &stream_reader;
+}
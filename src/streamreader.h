@@ -0,0 +1,25 @@
+#pragma once
+
+#include <objidl.h>
+#include <libheif/heif.h>
+
+// libheif reader over an IStream, so files are parsed and decoded without
+// being read into memory as a whole. Unknown boxes such as mdat are skipped
+// with a seek; only box headers, metadata and the data of the items actually
+// decoded are read. Reads past max_bytes in total fail.
+
+struct HEIF_STREAM_READER
+{
+    IStream* pStream;
+    UINT64 size;
+    UINT64 position;
+    UINT64 bytes_read;
+    UINT64 max_bytes;
+};
+
+// Initializes pReader for pStream, positioned at the start.
+// The stream must outlive any heif_context reading from it.
+HRESULT StreamReader_Init(HEIF_STREAM_READER* pReader, IStream* pStream, UINT64 max_bytes);
+
+// For heif_context_read_from_reader, with the HEIF_STREAM_READER as userdata
+const heif_reader* StreamReader_GetReader();
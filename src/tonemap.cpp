@@ -0,0 +1,181 @@
+#include <windows.h>
+#include <math.h>
+
+#include "tonemap.h"
+#include "log.h"
+
+// SDR reference white in nits, per ITU-R BT.2408
+const double REFERENCE_WHITE_NITS = 203.0;
+
+// Assumed peak of the mastering display, the HLG nominal peak
+const double PEAK_NITS = 1000.0;
+
+// SMPTE ST 2084 EOTF, returns nits
+double PQ_ToLinear(double e)
+{
+    const double m1 = 2610.0 / 16384.0;
+    const double m2 = 2523.0 / 4096.0 * 128.0;
+    const double c1 = 3424.0 / 4096.0;
+    const double c2 = 2413.0 / 4096.0 * 32.0;
+    const double c3 = 2392.0 / 4096.0 * 32.0;
+
+    double p = pow(e, 1.0 / m2);
+    double num = max(p - c1, 0.0);
+    double den = c2 - c3 * p;
+    return pow(num / den, 1.0 / m1) * 10000.0;
+}
+
+// ITU-R BT.2100 HLG inverse OETF, returns scene linear light 0..1
+double HLG_ToSceneLinear(double e)
+{
+    const double a = 0.17883277;
+    const double b = 1.0 - 4.0 * a;
+    const double c = 0.5 - a * log(4.0 * a);
+
+    return (e <= 0.5) ? (e * e / 3.0) : ((exp((e - c) / a) + b) / 12.0);
+}
+
+// HLG reference OOTF system gamma at a PEAK_NITS display
+const double HLG_SYSTEM_GAMMA = 1.2;
+
+// Extended Reinhard on a value relative to reference white, so that
+// PEAK_NITS lands exactly on 1.0 and the shadows and midtones are kept
+double ToneMap_Reinhard(double l)
+{
+    const double white = PEAK_NITS / REFERENCE_WHITE_NITS;
+    return l * (1.0 + l / (white * white)) / (1.0 + l);
+}
+
+double SRGB_FromLinear(double l)
+{
+    l = min(max(l, 0.0), 1.0);
+    return (l <= 0.0031308) ? (l * 12.92) : (1.055 * pow(l, 1.0 / 2.4) - 0.055);
+}
+
+double SRGB_ToLinear(double e)
+{
+    return (e <= 0.04045) ? (e / 12.92) : pow((e + 0.055) / 1.055, 2.4);
+}
+
+// Linear RGB to linear BT.709 RGB, per ITU-R BT.2087 for BT.2020,
+// and for Display P3 (SMPTE EG 432-1 primaries, D65 white)
+const float BT2020_TO_BT709[3][3] =
+{
+    {  1.6605f, -0.5876f, -0.0728f },
+    { -0.1246f,  1.1329f, -0.0083f },
+    { -0.0182f, -0.1006f,  1.1187f },
+};
+
+const float P3_TO_BT709[3][3] =
+{
+    {  1.2249f, -0.2247f,  0.0000f },
+    { -0.0420f,  1.0419f,  0.0000f },
+    { -0.0197f, -0.0786f,  1.0979f },
+};
+
+TONEMAP* ToneMap_Create(int bit_depth, const heif_color_profile_nclx* nclx)
+{
+    if (bit_depth < 8 || bit_depth > 16)
+        return NULL;
+
+    heif_transfer_characteristics transfer = nclx ? nclx->transfer_characteristics : heif_transfer_characteristic_unspecified;
+    heif_color_primaries primaries = nclx ? nclx->color_primaries : heif_color_primaries_unspecified;
+
+    bool is_hdr = (transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ ||
+        transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG);
+
+    // PQ and HLG without primaries are BT.2100, which uses the BT.2020 primaries
+    if (is_hdr && primaries == heif_color_primaries_unspecified)
+    {
+        primaries = heif_color_primaries_ITU_R_BT_2020_2_and_2100_0;
+    }
+
+    UINT count = 1u << bit_depth;
+    TONEMAP* tm = (TONEMAP*)LocalAlloc(LMEM_FIXED, sizeof(TONEMAP) + (count - 1) * sizeof(float));
+    if (!tm)
+        return NULL;
+
+    tm->bit_depth = bit_depth;
+    tm->transfer = transfer;
+    tm->convert_primaries = true;
+    if (primaries == heif_color_primaries_ITU_R_BT_2020_2_and_2100_0)
+    {
+        memcpy(tm->to_bt709, BT2020_TO_BT709, sizeof(tm->to_bt709));
+    }
+    else if (primaries == heif_color_primaries_SMPTE_EG_432_1)
+    {
+        memcpy(tm->to_bt709, P3_TO_BT709, sizeof(tm->to_bt709));
+    }
+    else
+    {
+        tm->convert_primaries = false;
+    }
+
+    Log_WriteFmt(LOG_DEBUG, L"tone map: %i bits, transfer %i, primaries %i", bit_depth, (int)transfer, (int)primaries);
+
+    // PQ: display light relative to reference white, HLG: scene light 0..1
+    // (the OOTF needs all three channels), anything else: display light 0..1
+    double max_value = (double)(count - 1);
+    for (UINT i = 0; i < count; ++i)
+    {
+        double e = i / max_value;
+        double l;
+
+        switch (transfer)
+        {
+        case heif_transfer_characteristic_ITU_R_BT_2100_0_PQ:
+            l = PQ_ToLinear(e) / REFERENCE_WHITE_NITS;
+            break;
+        case heif_transfer_characteristic_ITU_R_BT_2100_0_HLG:
+            l = HLG_ToSceneLinear(e);
+            break;
+        default:
+            l = SRGB_ToLinear(e);
+            break;
+        }
+
+        tm->linear[i] = (float)l;
+    }
+
+    return tm;
+}
+
+void ToneMap_Apply(const TONEMAP* tm, UINT r, UINT g, UINT b, BYTE rgb[3])
+{
+    UINT max_value = (1u << tm->bit_depth) - 1;
+    float c[3] = { tm->linear[min(r, max_value)], tm->linear[min(g, max_value)], tm->linear[min(b, max_value)] };
+
+    if (tm->transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG)
+    {
+        // BT.2100 reference OOTF, all channels scaled by the scene luminance
+        // to the power of gamma - 1, then to display light relative to reference white
+        float ys = 0.2627f * c[0] + 0.6780f * c[1] + 0.0593f * c[2];
+        float scale = (ys > 0.0f) ? (float)(PEAK_NITS / REFERENCE_WHITE_NITS) * powf(ys, (float)HLG_SYSTEM_GAMMA - 1.0f) : 0.0f;
+        c[0] *= scale;
+        c[1] *= scale;
+        c[2] *= scale;
+    }
+
+    if (tm->convert_primaries)
+    {
+        float s[3] = { c[0], c[1], c[2] };
+        for (int i = 0; i < 3; ++i)
+        {
+            c[i] = tm->to_bt709[i][0] * s[0] + tm->to_bt709[i][1] * s[1] + tm->to_bt709[i][2] * s[2];
+        }
+    }
+
+    bool is_hdr = (tm->transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ ||
+        tm->transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        // colors outside BT.709 are clipped
+        double l = max((double)c[i], 0.0);
+        if (is_hdr)
+        {
+            l = ToneMap_Reinhard(l);
+        }
+        rgb[i] = (BYTE)(SRGB_FromLinear(l) * 255.0 + 0.5);
+    }
+}
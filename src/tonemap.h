@@ -0,0 +1,27 @@
+#pragma once
+
+#include <libheif/heif.h>
+
+// Converts high bit depth RGB samples, after scaling, to 8 bit sRGB.
+//
+// Sample values go to linear light through a table, then the source primaries
+// are converted to BT.709, PQ and HLG content is tone mapped into SDR, and the
+// result is sRGB encoded. Anything that isn't PQ or HLG is assumed to be
+// display referred with an sRGB-like transfer and is only requantized (and
+// converted to BT.709 primaries if needed).
+
+struct TONEMAP
+{
+    int bit_depth;
+    heif_transfer_characteristics transfer;
+    bool convert_primaries;
+    float to_bt709[3][3];   // linear source RGB to linear BT.709 RGB
+    float linear[1];        // (1 << bit_depth) entries, see ToneMap_Create
+};
+
+// Builds the tone map for the given bit depth (8 to 16) and color profile,
+// nclx may be NULL. Free it with LocalFree.
+TONEMAP* ToneMap_Create(int bit_depth, const heif_color_profile_nclx* nclx);
+
+// r, g and b are samples of tm->bit_depth bits, rgb receives 8 bit sRGB
+void ToneMap_Apply(const TONEMAP* tm, UINT r, UINT g, UINT b, BYTE rgb[3]);
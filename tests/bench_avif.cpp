@@ -0,0 +1,164 @@
+// AVIF decode time with the dav1d thread budget at 1, 2, 4 and 8 threads,
+// decoding one image at a time and CONCURRENT images at once, as the shell
+// does. The budget is set through heif_dav1d_set_max_threads, which the
+// dav1d-threads patch in vcpkg-overlay exports; with a libheif without it
+// only dav1d's default is measured. make_corpus writes AVIF files to use.
+//
+//   bench_avif [-n passes] <file or directory>...     default 3 passes
+
+#include <windows.h>
+
+#include <libheif/heif.h>
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+int test_failures = 0;
+
+const int THREAD_BUDGETS[] = { 1, 2, 4, 8 };
+const int CONCURRENT = 4;
+
+typedef void (*PFN_HEIF_DAV1D_SET_MAX_THREADS)(int n_threads);
+
+struct AVIF_FILE
+{
+    std::string path;
+    std::vector<BYTE> data;
+};
+
+bool Decode(const AVIF_FILE& file)
+{
+    heif_context* ctx = heif_context_alloc();
+    heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data.data(), file.data.size(), NULL);
+
+    heif_image_handle* handle = NULL;
+    if (!err.code)
+        err = heif_context_get_primary_image_handle(ctx, &handle);
+
+    heif_image* image = NULL;
+    if (!err.code)
+        err = heif_decode_image(handle, &image, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, NULL);
+
+    if (err.code)
+        printf("%s: %s\n", file.path.c_str(), err.message);
+
+    heif_image_release(image);
+    heif_image_handle_release(handle);
+    heif_context_free(ctx);
+    return err.code == heif_error_Ok;
+}
+
+double CpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// Decodes every file passes times on thread_count threads, which share the
+// files between them; returns wall and CPU ms per image
+void Run(const std::vector<AVIF_FILE>& files, int passes, int thread_count, double* wall_ms, double* cpu_ms)
+{
+    std::vector<std::thread> threads;
+    double start = Test_Seconds();
+    double cpu_start = CpuSeconds();
+
+    for (int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                for (size_t i = t; i < files.size(); i += thread_count)
+                    CHECK(Decode(files[i]));
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    double images = (double)files.size() * passes;
+    *wall_ms = (Test_Seconds() - start) * 1000 / images;
+    *cpu_ms = (CpuSeconds() - cpu_start) * 1000 / images;
+}
+
+void AddFile(std::vector<AVIF_FILE>* files, const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    AVIF_FILE file;
+    file.path = path;
+    file.data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (!file.data.empty())
+        files->push_back(std::move(file));
+}
+
+int main(int argc, char** argv)
+{
+    int passes = 3;
+    std::vector<AVIF_FILE> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::error_code ec;
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            passes = max(atoi(argv[++i]), 1);
+        }
+        else if (std::filesystem::is_directory(argv[i], ec))
+        {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(argv[i], ec))
+            {
+                if (entry.is_regular_file() && entry.path().extension() == ".avif")
+                    AddFile(&files, entry.path().string());
+            }
+        }
+        else
+        {
+            AddFile(&files, argv[i]);
+        }
+    }
+
+    if (files.empty())
+    {
+        printf("usage: bench_avif [-n passes] <file or directory>...\n");
+        return 2;
+    }
+
+    PFN_HEIF_DAV1D_SET_MAX_THREADS pfnSetMaxThreads = (PFN_HEIF_DAV1D_SET_MAX_THREADS)dlsym(RTLD_DEFAULT, "heif_dav1d_set_max_threads");
+    if (!pfnSetMaxThreads)
+        printf("libheif has no heif_dav1d_set_max_threads, measuring dav1d's default only\n");
+
+    printf("%zu files x %i passes, %u hardware threads, ms per image\n", files.size(), passes, std::thread::hardware_concurrency());
+    printf("%-10s %12s %12s %16s %16s\n", "threads", "wall", "cpu", "wall, 4 at once", "cpu, 4 at once");
+
+    // warm up, so the first budget doesn't pay for loading dav1d
+    Decode(files[0]);
+
+    for (int budget : THREAD_BUDGETS)
+    {
+        if (pfnSetMaxThreads)
+            pfnSetMaxThreads(budget);
+
+        double wall_ms, cpu_ms, concurrent_wall_ms, concurrent_cpu_ms;
+        Run(files, passes, 1, &wall_ms, &cpu_ms);
+        Run(files, passes, CONCURRENT, &concurrent_wall_ms, &concurrent_cpu_ms);
+
+        char label[32];
+        snprintf(label, sizeof(label), pfnSetMaxThreads ? "%i" : "default", budget);
+        printf("%-10s %12.2f %12.2f %16.2f %16.2f\n", label, wall_ms, cpu_ms, concurrent_wall_ms, concurrent_cpu_ms);
+
+        if (!pfnSetMaxThreads)
+            break;
+    }
+
+    return Test_Result();
+}
@@ -0,0 +1,112 @@
+// Property handler probe throughput: Probe_ReadStream over every .heic, .heif,
+// .hif and .avif file under the given paths, reporting files per second and
+// how many bytes each probe reads against the size of the file. make_corpus
+// writes a synthetic corpus if there is no real one to hand.
+//
+//   bench_probe [-n passes] <file or directory>...     default 5 passes
+
+#include <windows.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "probe.h"
+#include "compat/stream.h"
+#include "test.h"
+
+int test_failures = 0;
+
+bool IsHeifPath(const std::filesystem::path& path)
+{
+    std::string ext = path.extension().string();
+    for (char& c : ext)
+        c = (char)tolower((unsigned char)c);
+    return ext == ".heic" || ext == ".heif" || ext == ".hif" || ext == ".avif";
+}
+
+void AddPaths(std::vector<std::string>* files, const char* arg)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(arg, ec))
+    {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(arg, ec))
+        {
+            if (entry.is_regular_file() && IsHeifPath(entry.path()))
+                files->push_back(entry.path().string());
+        }
+    }
+    else
+    {
+        files->push_back(arg);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int passes = 5;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            passes = max(atoi(argv[++i]), 1);
+        else
+            AddPaths(&files, argv[i]);
+    }
+
+    if (files.empty())
+    {
+        printf("usage: bench_probe [-n passes] <file or directory>...\n");
+        return 2;
+    }
+
+    UINT64 file_bytes = 0;
+    UINT64 bytes_read = 0;
+    UINT64 max_bytes_read = 0;
+    int failures = 0;
+    int with_date = 0;
+
+    double start = Test_Seconds();
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (const std::string& path : files)
+        {
+            CFileStream stream;
+            if (FAILED(stream.Open(path.c_str())))
+            {
+                printf("could not open %s\n", path.c_str());
+                return 1;
+            }
+
+            HEIF_PROBE_INFO info;
+            HRESULT hr = Probe_ReadStream(&stream, &info);
+
+            // only the first pass is counted, the others are for the timing
+            if (pass == 0)
+            {
+                ULARGE_INTEGER size;
+                IStream_Size(&stream, &size);
+                file_bytes += size.QuadPart;
+                bytes_read += stream.bytes_read;
+                max_bytes_read = max(max_bytes_read, stream.bytes_read);
+                failures += FAILED(hr) ? 1 : 0;
+                with_date += info.has_date_taken ? 1 : 0;
+
+                // what the probe reports is what the stream saw
+                CHECK(info.bytes_read == stream.bytes_read);
+                CHECK(stream.bytes_read <= PROBE_MAX_BYTES);
+            }
+        }
+    }
+    double seconds = Test_Seconds() - start;
+
+    size_t count = files.size();
+    printf("%zu files x %i passes: %.0f files/s, %.1f us per file\n",
+        count, passes, count * passes / seconds, seconds * 1e6 / (count * passes));
+    printf("failed %i, with a date taken %i\n", failures, with_date);
+    printf("bytes read: %.1f KB per file, most %.1f KB, %.2f%% of %.1f MB\n",
+        bytes_read / 1024.0 / count, max_bytes_read / 1024.0, bytes_read * 100.0 / max(file_bytes, (UINT64)1),
+        file_bytes / 1048576.0);
+
+    return Test_Result();
+}
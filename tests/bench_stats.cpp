@@ -0,0 +1,111 @@
+// Cost of Stats_Add and Stats_AddTime, from 1 to 16 threads, against a single
+// shared counter which every thread adds to. The counts are checked against
+// the slot totals afterwards; _build/HEICStats then reads the same block.
+//
+//   bench_stats [iterations per thread]     default 2000000
+
+#include <windows.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+#include "test.h"
+
+int test_failures = 0;
+
+extern STATS_BLOCK* pStats;
+
+const int THREAD_COUNTS[] = { 1, 2, 4, 8, 16 };
+
+volatile LONG64 shared_counter = 0;
+
+LONG64 SumCounter(STATS_COUNTER counter)
+{
+    LONG64 total = 0;
+    for (UINT s = 0; s < STATS_SLOT_COUNT; ++s)
+        total += ReadNoFence64(&pStats->slots[s].counters[counter]);
+    return total;
+}
+
+LONG64 SumTimerCount(STATS_TIMER timer)
+{
+    LONG64 total = 0;
+    for (UINT s = 0; s < STATS_SLOT_COUNT; ++s)
+        for (UINT i = 0; i < STATS_TIME_BUCKETS; ++i)
+            total += ReadNoFence64(&pStats->slots[s].time_buckets[timer][i]);
+    return total;
+}
+
+// Runs body on thread_count threads at once, returning the wall time per call
+// over all threads, which stays flat as long as the threads don't contend
+template <typename F>
+double Run(int thread_count, int iterations, F body)
+{
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            ++ready;
+            while (!go)
+            {
+            }
+            for (int i = 0; i < iterations; ++i)
+                body();
+        });
+    }
+
+    while (ready < thread_count)
+    {
+    }
+
+    double start = Test_Seconds();
+    go = true;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return (Test_Seconds() - start) * 1e9 / ((double)iterations * thread_count);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 2000000;
+    if (iterations <= 0)
+    {
+        printf("usage: bench_stats [iterations per thread]\n");
+        return 2;
+    }
+
+    Stats_Open();
+    if (!pStats)
+    {
+        printf("could not open the stats block\n");
+        return 1;
+    }
+
+    printf("%u hardware threads, ns per call\n", std::thread::hardware_concurrency());
+    printf("%-8s %16s %16s %16s\n", "threads", "Stats_Add", "Stats_AddTime", "shared add");
+    for (int thread_count : THREAD_COUNTS)
+    {
+        LONG64 adds_before = SumCounter(STAT_BYTES_READ);
+        LONG64 times_before = SumTimerCount(STAT_TIME_SNIFF);
+
+        double add_ns = Run(thread_count, iterations, []() { Stats_Add(STAT_BYTES_READ); });
+        double time_ns = Run(thread_count, iterations, []() { Stats_AddTime(STAT_TIME_SNIFF, Stats_Now()); });
+        double shared_ns = Run(thread_count, iterations, []() { InterlockedExchangeAddNoFence64(&shared_counter, 1); });
+
+        printf("%-8i %16.2f %16.2f %16.2f\n", thread_count, add_ns, time_ns, shared_ns);
+
+        // nothing is lost between the slots
+        CHECK(SumCounter(STAT_BYTES_READ) - adds_before == (LONG64)thread_count * iterations);
+        CHECK(SumTimerCount(STAT_TIME_SNIFF) - times_before == (LONG64)thread_count * iterations);
+    }
+
+    Stats_Close();
+    return Test_Result();
+}
@@ -0,0 +1,153 @@
+// Time and accuracy of the two ways a high bit depth image can become a
+// thumbnail: scaled at full depth and tone mapped per output pixel, or
+// truncated to 8 bits per sample first (what a decode at 8 bits gives) and
+// then scaled and tone mapped. Accuracy is against the double precision
+// reference applied to the exact area average.
+//
+//   bench_tonemap [width height [bit_depth]]     default 4000 3000 10
+
+#include <windows.h>
+
+#include <math.h>
+#include <vector>
+
+#include "scale.h"
+#include "tonemap.h"
+#include "tonemap_reference.h"
+#include "test.h"
+
+int test_failures = 0;
+
+const int THUMBNAIL_SIZE = 256;
+
+struct BENCH_RESULT
+{
+    double seconds;
+    double worst;
+    double mean;
+};
+
+// Dark and mid tone ramps, where 8 bit truncation of PQ shows most
+void FillSource(std::vector<uint16_t>* src, int width, int height, int bit_depth)
+{
+    int max_value = (1 << bit_depth) - 1;
+    for (int y = 0; y < height; ++y)
+    {
+        uint16_t* row = &(*src)[(SIZE_T)y * width * 4];
+        for (int x = 0; x < width; ++x)
+        {
+            row[x * 4 + 0] = (uint16_t)((INT64)x * max_value * 6 / 10 / width);
+            row[x * 4 + 1] = (uint16_t)((INT64)y * max_value * 6 / 10 / height);
+            row[x * 4 + 2] = (uint16_t)(max_value / 4 + ((x ^ y) & 63));
+            row[x * 4 + 3] = (uint16_t)max_value;
+        }
+    }
+}
+
+// Error of a BGRA thumbnail against the reference for the same source
+void Measure(BENCH_RESULT* result, const std::vector<REFERENCE_RGB>& reference, const std::vector<BYTE>& dest)
+{
+    double worst = 0;
+    double total = 0;
+    for (SIZE_T i = 0; i < reference.size(); ++i)
+    {
+        double errors[3] = { fabs(dest[i * 4 + 2] - reference[i].r), fabs(dest[i * 4 + 1] - reference[i].g), fabs(dest[i * 4 + 0] - reference[i].b) };
+        for (double e : errors)
+        {
+            worst = fmax(worst, e);
+            total += e;
+        }
+    }
+
+    result->worst = worst;
+    result->mean = total / (reference.size() * 3);
+}
+
+int main(int argc, char** argv)
+{
+    int width = (argc > 2) ? atoi(argv[1]) : 4000;
+    int height = (argc > 2) ? atoi(argv[2]) : 3000;
+    int bit_depth = (argc > 3) ? atoi(argv[3]) : 10;
+    if (width < THUMBNAIL_SIZE || height < THUMBNAIL_SIZE || bit_depth <= 8 || bit_depth > 16)
+    {
+        printf("usage: bench_tonemap [width height [bit_depth]], at least %i x %i, 9 to 16 bits\n", THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+        return 2;
+    }
+
+    int dest_width = THUMBNAIL_SIZE;
+    int dest_height = (int)((INT64)THUMBNAIL_SIZE * height / width);
+    int max_value = (1 << bit_depth) - 1;
+
+    std::vector<uint16_t> src((SIZE_T)width * height * 4);
+    FillSource(&src, width, height, bit_depth);
+
+    heif_color_profile_nclx nclx = {};
+    nclx.transfer_characteristics = heif_transfer_characteristic_ITU_R_BT_2100_0_PQ;
+    nclx.color_primaries = heif_color_primaries_ITU_R_BT_2020_2_and_2100_0;
+
+    // reference: exact area average at full precision, then the double pipeline
+    std::vector<REFERENCE_RGB> reference((SIZE_T)dest_width * dest_height);
+    for (int dy = 0; dy < dest_height; ++dy)
+    {
+        int y0 = (int)((INT64)dy * height / dest_height);
+        int y1 = (int)((INT64)(dy + 1) * height / dest_height);
+        for (int dx = 0; dx < dest_width; ++dx)
+        {
+            int x0 = (int)((INT64)dx * width / dest_width);
+            int x1 = (int)((INT64)(dx + 1) * width / dest_width);
+            double sum[3] = {};
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    for (int c = 0; c < 3; ++c)
+                        sum[c] += src[((SIZE_T)y * width + x) * 4 + c];
+
+            double n = (double)(x1 - x0) * (y1 - y0) * max_value;
+            reference[(SIZE_T)dy * dest_width + dx] = Reference_ToneMap(nclx.transfer_characteristics, nclx.color_primaries,
+                sum[0] / n, sum[1] / n, sum[2] / n);
+        }
+    }
+
+    std::vector<BYTE> dest((SIZE_T)dest_width * dest_height * 4);
+
+    // full depth: scale the 16 bit samples, tone map each output pixel
+    BENCH_RESULT full = {};
+    {
+        double start = Test_Seconds();
+        TONEMAP* tm = ToneMap_Create(bit_depth, &nclx);
+        CRowScaler scaler;
+        CHECK(SUCCEEDED(scaler.Init(width, height, dest_width, dest_height, dest.data(), dest_width * 4, bit_depth, tm)));
+        for (int y = 0; y < height; ++y)
+            scaler.PushRow(&src[(SIZE_T)y * width * 4]);
+        CHECK(scaler.IsComplete());
+        LocalFree(tm);
+        full.seconds = Test_Seconds() - start;
+        Measure(&full, reference, dest);
+    }
+
+    // truncate then scale: samples cut to 8 bits, then the 8 bit path
+    BENCH_RESULT truncated = {};
+    {
+        // not timed, a decode at 8 bits produces this buffer directly
+        int shift = bit_depth - 8;
+        std::vector<BYTE> src8((SIZE_T)width * height * 4);
+        for (SIZE_T i = 0; i < src8.size(); ++i)
+            src8[i] = (BYTE)(src[i] >> shift);
+
+        double start = Test_Seconds();
+        TONEMAP* tm = ToneMap_Create(8, &nclx);
+        CRowScaler scaler;
+        CHECK(SUCCEEDED(scaler.Init(width, height, dest_width, dest_height, dest.data(), dest_width * 4, 8, tm)));
+        for (int y = 0; y < height; ++y)
+            scaler.PushRow(&src8[(SIZE_T)y * width * 4]);
+        CHECK(scaler.IsComplete());
+        LocalFree(tm);
+        truncated.seconds = Test_Seconds() - start;
+        Measure(&truncated, reference, dest);
+    }
+
+    printf("%i x %i, %i bit PQ BT.2020 -> %i x %i\n", width, height, bit_depth, dest_width, dest_height);
+    printf("  %-22s %8.1f ms   worst error %5.2f   mean error %5.3f\n", "full depth", full.seconds * 1000, full.worst, full.mean);
+    printf("  %-22s %8.1f ms   worst error %5.2f   mean error %5.3f\n", "truncate then scale", truncated.seconds * 1000, truncated.worst, truncated.mean);
+
+    return Test_Result();
+}
@@ -0,0 +1,97 @@
+#include "stream.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HRESULT Compat_Seek(UINT64 size, UINT64* position, LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position)
+{
+    LONGLONG base = (origin == STREAM_SEEK_SET) ? 0 : (origin == STREAM_SEEK_CUR) ? (LONGLONG)*position : (LONGLONG)size;
+    if (base + move.QuadPart < 0)
+        return E_INVALIDARG;
+
+    *position = (UINT64)(base + move.QuadPart);
+    if (new_position)
+        new_position->QuadPart = *position;
+    return S_OK;
+}
+
+HRESULT CMemoryStream::Read(void* pv, ULONG cb, ULONG* pcbRead)
+{
+    UINT64 avail = (_position < _data.size()) ? _data.size() - _position : 0;
+    ULONG n = (ULONG)min((UINT64)cb, avail);
+    if (n)
+        memcpy(pv, &_data[_position], n);
+
+    _position += n;
+    bytes_read += n;
+    if (pcbRead)
+        *pcbRead = n;
+    return (n == cb) ? S_OK : S_FALSE;
+}
+
+HRESULT CMemoryStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position)
+{
+    return Compat_Seek(_data.size(), &_position, move, origin, new_position);
+}
+
+HRESULT CSparseStream::Read(void* pv, ULONG cb, ULONG* pcbRead)
+{
+    UINT64 avail = (_position < _size) ? _size - _position : 0;
+    ULONG n = (ULONG)min((UINT64)cb, avail);
+    UINT64 tail_start = _size - min((UINT64)_tail.size(), _size);
+    for (ULONG i = 0; i < n; ++i)
+    {
+        UINT64 p = _position + i;
+        ((BYTE*)pv)[i] = (p < _head.size()) ? _head[p] : (p >= tail_start) ? _tail[p - tail_start] : 0;
+    }
+
+    _position += n;
+    bytes_read += n;
+    if (pcbRead)
+        *pcbRead = n;
+    return (n == cb) ? S_OK : S_FALSE;
+}
+
+HRESULT CSparseStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position)
+{
+    return Compat_Seek(_size, &_position, move, origin, new_position);
+}
+
+CFileStream::~CFileStream()
+{
+    if (_fd >= 0)
+        close(_fd);
+}
+
+HRESULT CFileStream::Open(const char* path)
+{
+    _fd = open(path, O_RDONLY);
+    if (_fd < 0)
+        return E_FAIL;
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0)
+        return E_FAIL;
+
+    _size = (UINT64)st.st_size;
+    return S_OK;
+}
+
+HRESULT CFileStream::Read(void* pv, ULONG cb, ULONG* pcbRead)
+{
+    ssize_t n = pread(_fd, pv, cb, (off_t)_position);
+    if (n < 0)
+        return E_FAIL;
+
+    _position += (UINT64)n;
+    bytes_read += (UINT64)n;
+    if (pcbRead)
+        *pcbRead = (ULONG)n;
+    return ((ULONG)n == cb) ? S_OK : S_FALSE;
+}
+
+HRESULT CFileStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position)
+{
+    return Compat_Seek(_size, &_position, move, origin, new_position);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <windows.h>
+
+#include <vector>
+
+// IStream over a byte buffer, counting what is read through it
+class CMemoryStream : public IStream
+{
+public:
+    explicit CMemoryStream(const std::vector<BYTE>& data) : bytes_read(0), _data(data), _position(0)
+    {
+    }
+
+    HRESULT Read(void* pv, ULONG cb, ULONG* pcbRead) override;
+    HRESULT Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position) override;
+
+    UINT64 bytes_read;
+
+private:
+    const std::vector<BYTE>& _data;
+    UINT64 _position;
+};
+
+// IStream of size bytes which start with head, end with tail and are zero in
+// between, for synthetic files far larger than memory
+class CSparseStream : public IStream
+{
+public:
+    CSparseStream(const std::vector<BYTE>& head, UINT64 size, const std::vector<BYTE>& tail = std::vector<BYTE>()) :
+        bytes_read(0), _head(head), _tail(tail), _size(size), _position(0)
+    {
+    }
+
+    HRESULT Read(void* pv, ULONG cb, ULONG* pcbRead) override;
+    HRESULT Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position) override;
+
+    UINT64 bytes_read;
+
+private:
+    std::vector<BYTE> _head;
+    std::vector<BYTE> _tail;
+    UINT64 _size;
+    UINT64 _position;
+};
+
+// IStream over a file, read with pread so only what is asked for is touched
+class CFileStream : public IStream
+{
+public:
+    CFileStream() : bytes_read(0), _fd(-1), _size(0), _position(0)
+    {
+    }
+    ~CFileStream();
+
+    HRESULT Open(const char* path);
+
+    HRESULT Read(void* pv, ULONG cb, ULONG* pcbRead) override;
+    HRESULT Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position) override;
+
+    UINT64 bytes_read;
+
+private:
+    int _fd;
+    UINT64 _size;
+    UINT64 _position;
+};
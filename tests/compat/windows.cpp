@@ -0,0 +1,229 @@
+#include <windows.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+void* LocalAlloc(UINT flags, SIZE_T cb)
+{
+    return (flags & LPTR) ? calloc(1, cb) : malloc(cb);
+}
+
+void* LocalFree(void* p)
+{
+    free(p);
+    return NULL;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* count)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    count->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+void Sleep(DWORD ms)
+{
+    usleep((useconds_t)ms * 1000);
+}
+
+BOOL TzSpecificLocalTimeToSystemTime(const void*, const SYSTEMTIME* local, SYSTEMTIME* utc)
+{
+    tm t = {};
+    t.tm_year = local->wYear - 1900;
+    t.tm_mon = local->wMonth - 1;
+    t.tm_mday = local->wDay;
+    t.tm_hour = local->wHour;
+    t.tm_min = local->wMinute;
+    t.tm_sec = local->wSecond;
+    t.tm_isdst = -1;
+
+    time_t seconds = mktime(&t);
+    tm u;
+    if (seconds == (time_t)-1 || !gmtime_r(&seconds, &u))
+        return FALSE;
+
+    utc->wYear = (WORD)(u.tm_year + 1900);
+    utc->wMonth = (WORD)(u.tm_mon + 1);
+    utc->wDayOfWeek = (WORD)u.tm_wday;
+    utc->wDay = (WORD)u.tm_mday;
+    utc->wHour = (WORD)u.tm_hour;
+    utc->wMinute = (WORD)u.tm_min;
+    utc->wSecond = (WORD)u.tm_sec;
+    utc->wMilliseconds = local->wMilliseconds;
+    return TRUE;
+}
+
+BOOL SystemTimeToFileTime(const SYSTEMTIME* st, FILETIME* ft)
+{
+    if (st->wMonth < 1 || st->wMonth > 12 || st->wDay < 1 || st->wDay > 31 ||
+        st->wHour > 23 || st->wMinute > 59 || st->wSecond > 59)
+        return FALSE;
+
+    tm t = {};
+    t.tm_year = st->wYear - 1900;
+    t.tm_mon = st->wMonth - 1;
+    t.tm_mday = st->wDay;
+    t.tm_hour = st->wHour;
+    t.tm_min = st->wMinute;
+    t.tm_sec = st->wSecond;
+
+    // 100ns intervals since 1601-01-01
+    UINT64 ticks = ((UINT64)timegm(&t) + 11644473600ull) * 10000000 + (UINT64)st->wMilliseconds * 10000;
+    ft->dwLowDateTime = (DWORD)ticks;
+    ft->dwHighDateTime = (DWORD)(ticks >> 32);
+    return TRUE;
+}
+
+// Windows thread ids are multiples of 4, which Stats_GetSlot relies on. The id
+// is cached, as Windows reads it from the TEB rather than making a system call.
+DWORD GetCurrentThreadId()
+{
+    static thread_local DWORD thread_id = (DWORD)syscall(SYS_gettid) << 2;
+    return thread_id;
+}
+
+DWORD GetLastError()
+{
+    return (DWORD)errno;
+}
+
+// Shared memory
+
+struct COMPAT_MAPPING
+{
+    int fd;
+    SIZE_T size;
+};
+
+std::mutex views_lock;
+std::map<const void*, SIZE_T> views;
+
+std::string Compat_ShmName(PCWSTR name)
+{
+    const wchar_t* base = wcsrchr(name, L'\\');
+    base = base ? base + 1 : name;
+
+    std::string result = "/";
+    for (; *base; ++base)
+        result += (char)*base;
+    return result;
+}
+
+HANDLE CreateFileMappingW(HANDLE, void*, DWORD, DWORD size_high, DWORD size_low, PCWSTR name)
+{
+    SIZE_T size = ((SIZE_T)size_high << 32) | size_low;
+
+    int fd = shm_open(Compat_ShmName(name).c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return NULL;
+
+    // like Windows, a new mapping is zeroed and an existing one keeps its contents
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((SIZE_T)st.st_size < size && ftruncate(fd, (off_t)size) != 0))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    return new COMPAT_MAPPING{ fd, size };
+}
+
+HANDLE OpenFileMappingW(DWORD access, BOOL, PCWSTR name)
+{
+    int fd = shm_open(Compat_ShmName(name).c_str(), (access & FILE_MAP_WRITE) ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    return new COMPAT_MAPPING{ fd, (SIZE_T)st.st_size };
+}
+
+void* MapViewOfFile(HANDLE mapping, DWORD access, DWORD, DWORD, SIZE_T size)
+{
+    COMPAT_MAPPING* m = (COMPAT_MAPPING*)mapping;
+    if (size == 0)
+        size = m->size;
+
+    if (size > m->size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int prot = PROT_READ | ((access & FILE_MAP_WRITE) ? PROT_WRITE : 0);
+    void* view = mmap(NULL, size, prot, MAP_SHARED, m->fd, 0);
+    if (view == MAP_FAILED)
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(views_lock);
+    views[view] = size;
+    return view;
+}
+
+BOOL UnmapViewOfFile(const void* view)
+{
+    std::lock_guard<std::mutex> lock(views_lock);
+    auto it = views.find(view);
+    if (it == views.end())
+        return FALSE;
+
+    munmap((void*)view, it->second);
+    views.erase(it);
+    return TRUE;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+    COMPAT_MAPPING* m = (COMPAT_MAPPING*)h;
+    close(m->fd);
+    delete m;
+    return TRUE;
+}
+
+// IStream helpers from shlwapi
+
+HRESULT IStream_Size(IStream* stream, ULARGE_INTEGER* size)
+{
+    LARGE_INTEGER zero = {};
+    ULARGE_INTEGER current;
+    HRESULT hr = stream->Seek(zero, STREAM_SEEK_CUR, &current);
+    if (SUCCEEDED(hr))
+    {
+        hr = stream->Seek(zero, STREAM_SEEK_END, size);
+        if (SUCCEEDED(hr))
+        {
+            LARGE_INTEGER restore;
+            restore.QuadPart = (LONGLONG)current.QuadPart;
+            hr = stream->Seek(restore, STREAM_SEEK_SET, NULL);
+        }
+    }
+    return hr;
+}
+
+HRESULT IStream_Reset(IStream* stream)
+{
+    LARGE_INTEGER zero = {};
+    return stream->Seek(zero, STREAM_SEEK_SET, NULL);
+}
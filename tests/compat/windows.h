@@ -0,0 +1,165 @@
+#pragma once
+
+// Just enough of the Win32 API for the portable parts of the handler (scaling,
+// tone mapping, sniffing, probing, stats) to build and run on Linux.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <type_traits>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef uint32_t ULONG;
+typedef int32_t LONG;
+typedef unsigned int UINT;
+typedef long long INT64;
+typedef unsigned long long UINT64;
+typedef long long LONG64;
+typedef unsigned long long ULONG64;
+typedef long long LONGLONG;
+typedef size_t SIZE_T;
+typedef int32_t HRESULT;
+typedef wchar_t WCHAR;
+typedef const wchar_t* PCWSTR;
+typedef wchar_t* PWSTR;
+typedef void* HANDLE;
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAXDWORD 0xffffffffu
+#define MAXUINT64 UINT64_MAX
+
+#define S_OK            ((HRESULT)0)
+#define S_FALSE         ((HRESULT)1)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_UNEXPECTED    ((HRESULT)0x8000FFFF)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#define ERROR_FILE_NOT_FOUND    2
+#define ERROR_BAD_FORMAT        11
+#define ERROR_INVALID_DATA      13
+#define HRESULT_FROM_WIN32(x)   ((HRESULT)(x) <= 0 ? (HRESULT)(x) : (HRESULT)(((x) & 0x0000FFFF) | 0x80070000))
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define ZeroMemory(p, cb) memset((p), 0, (cb))
+
+// __declspec(align(n)) is the only __declspec used by the portable sources
+#define __declspec(x) __declspec_##x
+#define __declspec_align(n) __attribute__((aligned(n)))
+
+// windows.h min/max, as functions so they don't break the standard headers
+template <typename A, typename B, typename T = typename std::common_type<A, B>::type>
+inline T min(A a, B b) { return ((T)b < (T)a) ? (T)b : (T)a; }
+template <typename A, typename B, typename T = typename std::common_type<A, B>::type>
+inline T max(A a, B b) { return ((T)a < (T)b) ? (T)b : (T)a; }
+
+// Memory
+
+#define LMEM_FIXED  0x0000
+#define LPTR        0x0040
+
+void* LocalAlloc(UINT flags, SIZE_T cb);
+void* LocalFree(void* p);
+
+// Time
+
+typedef union
+{
+    struct { DWORD LowPart; LONG HighPart; };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union
+{
+    struct { DWORD LowPart; DWORD HighPart; };
+    UINT64 QuadPart;
+} ULARGE_INTEGER;
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct SYSTEMTIME
+{
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+};
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency);
+BOOL QueryPerformanceCounter(LARGE_INTEGER* count);
+void Sleep(DWORD ms);
+
+// Converts using the TZ of the test process, like Windows uses the current time zone
+BOOL TzSpecificLocalTimeToSystemTime(const void* tz, const SYSTEMTIME* local, SYSTEMTIME* utc);
+BOOL SystemTimeToFileTime(const SYSTEMTIME* st, FILETIME* ft);
+
+#define sscanf_s sscanf
+#define _wcsicmp wcscasecmp
+
+// Threads and atomics
+
+DWORD GetCurrentThreadId();
+DWORD GetLastError();
+
+inline LONG64 InterlockedExchangeAddNoFence64(volatile LONG64* addend, LONG64 value)
+{
+    return __atomic_fetch_add(addend, value, __ATOMIC_RELAXED);
+}
+
+inline LONG64 InterlockedCompareExchangeNoFence64(volatile LONG64* dest, LONG64 exchange, LONG64 comparand)
+{
+    __atomic_compare_exchange_n(dest, &comparand, exchange, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return comparand;
+}
+
+inline LONG64 ReadNoFence64(const volatile LONG64* src)
+{
+    return __atomic_load_n(src, __ATOMIC_RELAXED);
+}
+
+// Named shared memory, as POSIX shared memory objects: "Local\Name" is /dev/shm/Name
+
+#define INVALID_HANDLE_VALUE    ((HANDLE)(intptr_t)-1)
+#define PAGE_READWRITE          0x04
+#define FILE_MAP_WRITE          0x0002
+#define FILE_MAP_READ           0x0004
+
+HANDLE CreateFileMappingW(HANDLE file, void* security, DWORD protect, DWORD size_high, DWORD size_low, PCWSTR name);
+HANDLE OpenFileMappingW(DWORD access, BOOL inherit, PCWSTR name);
+void* MapViewOfFile(HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, SIZE_T size);
+BOOL UnmapViewOfFile(const void* view);
+BOOL CloseHandle(HANDLE h);
+
+// IStream, only the members the handler uses
+
+#define STREAM_SEEK_SET 0
+#define STREAM_SEEK_CUR 1
+#define STREAM_SEEK_END 2
+
+struct IStream
+{
+    virtual ~IStream() {}
+    virtual HRESULT Read(void* pv, ULONG cb, ULONG* pcbRead) = 0;
+    virtual HRESULT Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* new_position) = 0;
+};
+
+HRESULT IStream_Size(IStream* stream, ULARGE_INTEGER* size);
+HRESULT IStream_Reset(IStream* stream);
@@ -0,0 +1,29 @@
+// main for tools written with wmain, arguments converted from the locale's multibyte encoding
+
+#include <windows.h>
+
+#include <locale.h>
+#include <string>
+#include <vector>
+
+int wmain(int argc, wchar_t** argv);
+
+int main(int argc, char** argv)
+{
+    setlocale(LC_ALL, "");
+
+    std::vector<std::wstring> args(argc);
+    std::vector<wchar_t*> wargv(argc + 1, nullptr);
+    for (int i = 0; i < argc; ++i)
+    {
+        size_t cch = mbstowcs(NULL, argv[i], 0);
+        if (cch != (size_t)-1)
+        {
+            args[i].resize(cch);
+            mbstowcs(&args[i][0], argv[i], cch + 1);
+        }
+        wargv[i] = &args[i][0];
+    }
+
+    return wmain(argc, wargv.data());
+}
@@ -0,0 +1,131 @@
+// Writes a corpus of small synthetic HEIC and AVIF files for the probe and
+// AVIF benchmarks, with Exif dates, some embedded thumbnails and a spread of
+// sizes. Needs a libheif with the x265 and aom encoders.
+//
+//   make_corpus <directory> [count]     default 24 files
+
+#include <windows.h>
+
+#include <libheif/heif.h>
+
+#include <stdio.h>
+#include <vector>
+
+struct CORPUS_SIZE
+{
+    int width;
+    int height;
+};
+
+const CORPUS_SIZE CORPUS_SIZES[] = { { 640, 480 }, { 1920, 1080 }, { 3024, 4032 } };
+
+// Big endian TIFF with IFD0 -> Exif IFD -> DateTimeOriginal
+std::vector<BYTE> MakeExif(int index)
+{
+    char date[32];
+    snprintf(date, sizeof(date), "2024:%02d:%02d 12:%02d:00", 1 + index % 12, 1 + index % 28, index % 60);
+
+    BYTE tiff[] =
+    {
+        'M', 'M', 0, 42, 0, 0, 0, 8,
+        // IFD0 at 8: one entry, ExifIFD pointer to 26
+        0, 1, 0x87, 0x69, 0, 4, 0, 0, 0, 1, 0, 0, 0, 26, 0, 0, 0, 0,
+        // Exif IFD at 26: one entry, DateTimeOriginal, 20 ASCII at 44
+        0, 1, 0x90, 0x03, 0, 2, 0, 0, 0, 20, 0, 0, 0, 44, 0, 0, 0, 0,
+    };
+
+    std::vector<BYTE> exif(sizeof(tiff) + 20);
+    memcpy(exif.data(), tiff, sizeof(tiff));
+    memcpy(exif.data() + sizeof(tiff), date, 20);
+    return exif;
+}
+
+bool Check(heif_error err, const char* what)
+{
+    if (err.code)
+        printf("%s: %s\n", what, err.message);
+    return err.code == heif_error_Ok;
+}
+
+bool WriteFile(const char* path, int index)
+{
+    bool avif = (index % 2) != 0;
+    CORPUS_SIZE size = CORPUS_SIZES[(index / 2) % ARRAYSIZE(CORPUS_SIZES)];
+
+    heif_image* image = NULL;
+    if (!Check(heif_image_create(size.width, size.height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &image), "create"))
+        return false;
+
+    heif_image_add_plane(image, heif_channel_interleaved, size.width, size.height, 8);
+    int stride = 0;
+    uint8_t* plane = heif_image_get_plane(image, heif_channel_interleaved, &stride);
+    for (int y = 0; y < size.height; ++y)
+    {
+        for (int x = 0; x < size.width; ++x)
+        {
+            uint8_t* p = &plane[(SIZE_T)y * stride + x * 3];
+            p[0] = (uint8_t)(x * 255 / size.width);
+            p[1] = (uint8_t)(y * 255 / size.height);
+            p[2] = (uint8_t)(((x / 16) ^ (y / 16) ^ index) * 37);
+        }
+    }
+
+    heif_context* ctx = heif_context_alloc();
+    heif_encoder* encoder = NULL;
+    bool ok = Check(heif_context_get_encoder_for_format(ctx, avif ? heif_compression_AV1 : heif_compression_HEVC, &encoder), "encoder");
+    if (ok)
+    {
+        heif_encoder_set_lossy_quality(encoder, 60);
+        if (avif)
+            heif_encoder_set_parameter_integer(encoder, "speed", 9);
+        else
+            heif_encoder_set_parameter_string(encoder, "preset", "ultrafast");
+
+        heif_image_handle* handle = NULL;
+        ok = Check(heif_context_encode_image(ctx, image, encoder, NULL, &handle), "encode");
+        if (ok)
+        {
+            std::vector<BYTE> exif = MakeExif(index);
+            ok = Check(heif_context_add_exif_metadata(ctx, handle, exif.data(), (int)exif.size()), "exif");
+
+            if (ok && index % 3 == 0)
+            {
+                heif_image_handle* thumbnail = NULL;
+                ok = Check(heif_context_encode_thumbnail(ctx, image, handle, encoder, NULL, 320, &thumbnail), "thumbnail");
+                heif_image_handle_release(thumbnail);
+            }
+
+            heif_image_handle_release(handle);
+        }
+
+        if (ok)
+            ok = Check(heif_context_write_to_file(ctx, path), "write");
+
+        heif_encoder_release(encoder);
+    }
+
+    heif_context_free(ctx);
+    heif_image_release(image);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: make_corpus <directory> [count]\n");
+        return 2;
+    }
+
+    int count = (argc > 2) ? atoi(argv[2]) : 24;
+    for (int i = 0; i < count; ++i)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/corpus_%03d.%s", argv[1], i, (i % 2) ? "avif" : "heic");
+        if (!WriteFile(path, i))
+            return 1;
+        printf("%s\n", path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Minimal checks for the Linux tests: failures are printed and counted, and
+// main returns Test_Result() so make check stops on the first failing binary.
+
+extern int test_failures;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { ++test_failures; printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+    do { double a_ = (a), b_ = (b); if (a_ - b_ > (tolerance) || b_ - a_ > (tolerance)) { ++test_failures; \
+        printf("%s:%d: CHECK_NEAR failed: %s = %g, %s = %g\n", __FILE__, __LINE__, #a, a_, #b, b_); } } while (0)
+
+inline int Test_Result()
+{
+    printf("%s (%d failures)\n", test_failures ? "FAILED" : "passed", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+inline double Test_Seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+inline long Test_ReadStatusKB(const char* field)
+{
+    long kb = -1;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f)
+    {
+        char line[256];
+        size_t len = strlen(field);
+        while (fgets(line, sizeof(line), f))
+        {
+            if (strncmp(line, field, len) == 0 && line[len] == ':')
+            {
+                kb = atol(&line[len + 1]);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    return kb;
+}
+
+// Resets the peak resident set size to the current one, so each measurement
+// starts from where the process is now rather than from its earlier peaks
+inline void Test_ResetPeakRss()
+{
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f)
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+inline long Test_RssKB()
+{
+    return Test_ReadStatusKB("VmRSS");
+}
+
+// Peak resident set size since the last Test_ResetPeakRss
+inline long Test_PeakRssKB()
+{
+    return Test_ReadStatusKB("VmHWM");
+}
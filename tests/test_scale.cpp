@@ -0,0 +1,196 @@
+// CRowScaler: output against an exact area average, and peak memory when a
+// 20000 x 5000 grid image is pushed through it one row of tiles at a time.
+
+#include <windows.h>
+
+#include <math.h>
+#include <vector>
+
+#include "scale.h"
+#include "test.h"
+
+int test_failures = 0;
+
+const int GRID_WIDTH = 20000;
+const int GRID_HEIGHT = 5000;
+const int GRID_TILE_SIZE = 500;     // 40 x 10 tiles
+const int THUMBNAIL_SIZE = 256;
+
+// Deterministic test pattern, different in every channel
+template <typename T>
+T Pattern(int x, int y, int c, int max_value)
+{
+    return (T)(((x * (c + 1) * 7) ^ (y * (c + 3) * 5) ^ (x * y)) % (max_value + 1));
+}
+
+// Each row of tiles is decoded into its own buffer, pushed and freed before the
+// next one, as a tile decoder would; the scaler itself must add only the output.
+template <typename T>
+void TestGridPeakMemory(int bit_depth)
+{
+    int max_value = (1 << bit_depth) - 1;
+    int dest_width = THUMBNAIL_SIZE;
+    int dest_height = THUMBNAIL_SIZE * GRID_HEIGHT / GRID_WIDTH;
+
+    TONEMAP* tonemap = (bit_depth > 8) ? ToneMap_Create(bit_depth, NULL) : NULL;
+
+    std::vector<BYTE> dest((SIZE_T)dest_width * dest_height * 4);
+
+    Test_ResetPeakRss();
+    long rss_before = Test_RssKB();
+
+    CRowScaler scaler;
+    HRESULT hr = scaler.Init(GRID_WIDTH, GRID_HEIGHT, dest_width, dest_height, dest.data(), dest_width * 4,
+        bit_depth, tonemap);
+    CHECK(SUCCEEDED(hr));
+
+    SIZE_T band_stride = (SIZE_T)GRID_WIDTH * 4;
+    for (int band_y = 0; band_y < GRID_HEIGHT; band_y += GRID_TILE_SIZE)
+    {
+        T* band = (T*)malloc(band_stride * GRID_TILE_SIZE * sizeof(T));
+        for (int y = 0; y < GRID_TILE_SIZE; ++y)
+        {
+            T* row = &band[y * band_stride];
+            for (int x = 0; x < GRID_WIDTH; ++x)
+            {
+                row[x * 4 + 0] = (T)(x * max_value / GRID_WIDTH);
+                row[x * 4 + 1] = (T)((band_y + y) * max_value / GRID_HEIGHT);
+                row[x * 4 + 2] = (T)(max_value / 2);
+                row[x * 4 + 3] = (T)max_value;
+            }
+        }
+
+        for (int y = 0; y < GRID_TILE_SIZE; ++y)
+            scaler.PushRow(&band[y * band_stride]);
+
+        free(band);
+    }
+
+    CHECK(scaler.IsComplete());
+
+    long band_kb = (long)(band_stride * GRID_TILE_SIZE * sizeof(T) / 1024);
+    long full_kb = band_kb * (GRID_HEIGHT / GRID_TILE_SIZE);
+    long growth_kb = Test_PeakRssKB() - rss_before;
+    printf("%i bit %i x %i grid: peak RSS growth %ld KB, one row of tiles %ld KB, whole image %ld KB\n",
+        bit_depth, GRID_WIDTH, GRID_HEIGHT, growth_kb, band_kb, full_kb);
+
+    // one row of tiles plus a little slack for the scaler's own output-width row
+    CHECK(growth_kb < band_kb + 4 * 1024);
+
+    // the ramps survive the scaling: left/right and top/bottom
+    CHECK(dest[2] < 8 && dest[(dest_width - 1) * 4 + 2] > 247);
+    CHECK(dest[1] < 8 && dest[((SIZE_T)dest_height - 1) * dest_width * 4 + 1] > 247);
+
+    LocalFree(tonemap);
+}
+
+// Compares every output pixel with a direct area average of the source
+void TestAreaAverage(int src_width, int src_height, int dest_width, int dest_height)
+{
+    std::vector<BYTE> src((SIZE_T)src_width * src_height * 4);
+    for (int y = 0; y < src_height; ++y)
+        for (int x = 0; x < src_width; ++x)
+            for (int c = 0; c < 4; ++c)
+                src[((SIZE_T)y * src_width + x) * 4 + c] = Pattern<BYTE>(x, y, c, 255);
+
+    std::vector<BYTE> dest((SIZE_T)dest_width * dest_height * 4);
+    CRowScaler scaler;
+    CHECK(SUCCEEDED(scaler.Init(src_width, src_height, dest_width, dest_height, dest.data(), dest_width * 4)));
+    for (int y = 0; y < src_height; ++y)
+        scaler.PushRow(&src[(SIZE_T)y * src_width * 4]);
+    CHECK(scaler.IsComplete());
+
+    int worst = 0;
+    for (int dy = 0; dy < dest_height; ++dy)
+    {
+        int y0 = (int)((INT64)dy * src_height / dest_height);
+        int y1 = (int)((INT64)(dy + 1) * src_height / dest_height);
+        for (int dx = 0; dx < dest_width; ++dx)
+        {
+            int x0 = (int)((INT64)dx * src_width / dest_width);
+            int x1 = (int)((INT64)(dx + 1) * src_width / dest_width);
+            for (int c = 0; c < 4; ++c)
+            {
+                double sum = 0;
+                for (int y = y0; y < y1; ++y)
+                    for (int x = x0; x < x1; ++x)
+                        sum += src[((SIZE_T)y * src_width + x) * 4 + c];
+                double expected = sum / ((double)(x1 - x0) * (y1 - y0));
+
+                // RGBA in, BGRA out
+                int out_c = (c == 3) ? 3 : 2 - c;
+                int actual = dest[((SIZE_T)dy * dest_width + dx) * 4 + out_c];
+                worst = max(worst, (int)(fabs(actual - expected) + 0.5));
+            }
+        }
+    }
+
+    printf("area average %i x %i -> %i x %i: worst error %i\n", src_width, src_height, dest_width, dest_height, worst);
+    CHECK(worst <= 1);
+}
+
+// 8 bit sources may still be tone mapped, for HDR images decoded at 8 bits
+void TestToneMap8()
+{
+    heif_color_profile_nclx nclx = {};
+    nclx.color_primaries = heif_color_primaries_ITU_R_BT_2020_2_and_2100_0;
+    nclx.transfer_characteristics = heif_transfer_characteristic_ITU_R_BT_2100_0_PQ;
+    TONEMAP* tonemap = ToneMap_Create(8, &nclx);
+    CHECK(tonemap != NULL);
+
+    BYTE src[4 * 4] = {};
+    for (int x = 0; x < 4; ++x)
+    {
+        src[x * 4 + 0] = 150;
+        src[x * 4 + 1] = 100;
+        src[x * 4 + 2] = 50;
+        src[x * 4 + 3] = 200;
+    }
+
+    BYTE dest[4];
+    CRowScaler scaler;
+    CHECK(SUCCEEDED(scaler.Init(4, 1, 1, 1, dest, 4, 8, tonemap)));
+    scaler.PushRow(src);
+    CHECK(scaler.IsComplete());
+
+    // BGRA, alpha is never mapped
+    BYTE rgb[3];
+    ToneMap_Apply(tonemap, 150, 100, 50, rgb);
+    CHECK(dest[0] == rgb[2] && dest[1] == rgb[1] && dest[2] == rgb[0] && dest[3] == 200);
+
+    LocalFree(tonemap);
+}
+
+void TestInvalidArguments()
+{
+    BYTE dest[16];
+    CRowScaler upscale;
+    CHECK(upscale.Init(2, 2, 4, 1, dest, 16) == E_INVALIDARG);
+
+    CRowScaler no_tonemap;
+    CHECK(no_tonemap.Init(4, 4, 2, 2, dest, 8, 10, NULL) == E_INVALIDARG);
+
+    TONEMAP* tonemap_12 = ToneMap_Create(12, NULL);
+    CRowScaler wrong_depth;
+    CHECK(wrong_depth.Init(4, 4, 2, 2, dest, 8, 10, tonemap_12) == E_INVALIDARG);
+    LocalFree(tonemap_12);
+
+    CRowScaler twice;
+    CHECK(SUCCEEDED(twice.Init(4, 4, 2, 2, dest, 8)));
+    CHECK(twice.Init(4, 4, 2, 2, dest, 8) == E_UNEXPECTED);
+}
+
+int main()
+{
+    TestGridPeakMemory<uint8_t>(8);
+    TestGridPeakMemory<uint16_t>(10);
+
+    TestAreaAverage(1003, 517, 256, 131);
+    TestAreaAverage(640, 480, 640, 480);
+    TestAreaAverage(7, 5, 3, 2);
+    TestAreaAverage(4000, 3, 256, 1);
+    TestToneMap8();
+    TestInvalidArguments();
+
+    return Test_Result();
+}
@@ -0,0 +1,352 @@
+// Sniff_CheckStream and Sniff_CheckFileType on synthetic files: valid ones,
+// unsupported brands, truncated and malformed boxes, and files built to be
+// expensive to parse (oversized meta, huge ispe, many items or tiles, many
+// top level boxes). Rejections must be cheap: nothing read but the ftyp, the
+// top level box headers and at most the meta box, and no memory held beyond it.
+
+#include <windows.h>
+
+#include <math.h>
+#include <vector>
+
+#include "sniff.h"
+#include "compat/stream.h"
+#include "test.h"
+
+int test_failures = 0;
+
+typedef std::vector<BYTE> BYTES;
+
+const HRESULT HR_BAD_FORMAT = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+const HRESULT HR_INVALID_DATA = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+void Append16(BYTES* b, UINT v)
+{
+    b->push_back((BYTE)(v >> 8));
+    b->push_back((BYTE)v);
+}
+
+void Append32(BYTES* b, UINT v)
+{
+    Append16(b, v >> 16);
+    Append16(b, v & 0xffff);
+}
+
+void Append(BYTES* b, const BYTES& more)
+{
+    b->insert(b->end(), more.begin(), more.end());
+}
+
+BYTES Box(const char* type, const BYTES& payload)
+{
+    BYTES b;
+    Append32(&b, (UINT)(8 + payload.size()));
+    b.insert(b.end(), type, type + 4);
+    Append(&b, payload);
+    return b;
+}
+
+BYTES FullBox(const char* type, BYTE version, const BYTES& payload)
+{
+    BYTES p = { version, 0, 0, 0 };
+    Append(&p, payload);
+    return Box(type, p);
+}
+
+BYTES Ftyp(const char* major, const char* compatible)
+{
+    BYTES p(major, major + 4);
+    Append32(&p, 0);
+    p.insert(p.end(), compatible, compatible + strlen(compatible));
+    return Box("ftyp", p);
+}
+
+BYTES Ispe(UINT width, UINT height)
+{
+    BYTES p;
+    Append32(&p, width);
+    Append32(&p, height);
+    return FullBox("ispe", 0, p);
+}
+
+// iinf with item_count infe entries
+BYTES Iinf(UINT item_count)
+{
+    BYTES p;
+    Append32(&p, item_count);
+    for (UINT i = 1; i <= item_count; ++i)
+    {
+        BYTES infe;
+        Append16(&infe, i);
+        Append16(&infe, 0);
+        infe.insert(infe.end(), { 'h', 'v', 'c', '1', 0 });
+        Append(&p, FullBox("infe", 2, infe));
+    }
+    return FullBox("iinf", 1, p);
+}
+
+// iref with one grid item referencing tile_count tiles
+BYTES Iref(UINT tile_count)
+{
+    BYTES dimg;
+    Append16(&dimg, 0xffff);
+    Append16(&dimg, tile_count);
+    for (UINT i = 1; i <= tile_count; ++i)
+        Append16(&dimg, i);
+
+    return FullBox("iref", 0, Box("dimg", dimg));
+}
+
+BYTES Meta(UINT item_count, UINT tile_count, UINT width, UINT height)
+{
+    BYTES p;
+    Append(&p, FullBox("hdlr", 0, BYTES(20, 0)));
+    Append(&p, Iinf(item_count));
+    if (tile_count)
+        Append(&p, Iref(tile_count));
+    Append(&p, Box("iprp", Box("ipco", Ispe(width, height))));
+    return FullBox("meta", 0, p);
+}
+
+BYTES File(const BYTES& meta, UINT mdat_size = 1000)
+{
+    BYTES f = Ftyp("heic", "mif1heic");
+    Append(&f, meta);
+    Append(&f, Box("mdat", BYTES(mdat_size, 0x55)));
+    return f;
+}
+
+struct SNIFF_RESULT
+{
+    HRESULT hr;
+    ULONG cbRead;
+    UINT64 stream_bytes_read;
+    UINT64 position;
+    double seconds;
+};
+
+// declared_size pads the file with zeros after data
+SNIFF_RESULT Sniff(const BYTES& data, UINT64 declared_size = 0)
+{
+    CSparseStream stream(data, declared_size ? declared_size : data.size());
+
+    SNIFF_RESULT result = {};
+    double start = Test_Seconds();
+    result.hr = Sniff_CheckStream(&stream, declared_size ? declared_size : data.size(), &result.cbRead);
+    result.seconds = Test_Seconds() - start;
+    result.stream_bytes_read = stream.bytes_read;
+
+    ULARGE_INTEGER position;
+    LARGE_INTEGER zero = {};
+    stream.Seek(zero, STREAM_SEEK_CUR, &position);
+    result.position = position.QuadPart;
+    return result;
+}
+
+// Every sniff reports exactly what it read and leaves the stream at the start
+void CheckCommon(const SNIFF_RESULT& r, const char* name)
+{
+    printf("%-28s hr 0x%08x, %7u bytes read, %8.1f us\n", name, (UINT)r.hr, r.cbRead, r.seconds * 1e6);
+    CHECK(r.cbRead == r.stream_bytes_read);
+    CHECK(r.position == 0);
+}
+
+void TestValid()
+{
+    SNIFF_RESULT r = Sniff(File(Meta(3, 2, 4032, 3024)));
+    CheckCommon(r, "valid");
+    CHECK(r.hr == S_OK);
+
+    // the mdat payload is seeked over, never read
+    BYTES f = File(Meta(3, 2, 4032, 3024), 100000);
+    r = Sniff(f);
+    CheckCommon(r, "valid, large mdat");
+    CHECK(r.hr == S_OK);
+    CHECK(r.cbRead < 1024);
+
+    // AVIF, and brands only in the compatible list
+    BYTES avif = Ftyp("avif", "mif1miaf");
+    Append(&avif, Meta(1, 0, 1920, 1080));
+    r = Sniff(avif);
+    CheckCommon(r, "avif");
+    CHECK(r.hr == S_OK);
+
+    BYTES miaf = Ftyp("miaf", "isommif1");
+    Append(&miaf, Meta(1, 0, 1920, 1080));
+    r = Sniff(miaf);
+    CheckCommon(r, "compatible brand");
+    CHECK(r.hr == S_OK);
+}
+
+void TestBadFormat()
+{
+    BYTES mp4 = Ftyp("isom", "isomavc1");
+    Append(&mp4, Box("mdat", BYTES(100, 0)));
+    SNIFF_RESULT r = Sniff(mp4);
+    CheckCommon(r, "unsupported brand");
+    CHECK(r.hr == HR_BAD_FORMAT);
+
+    BYTES jpeg = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0 };
+    jpeg.resize(2000, 0);
+    r = Sniff(jpeg);
+    CheckCommon(r, "jpeg");
+    CHECK(r.hr == HR_BAD_FORMAT);
+    CHECK(r.cbRead <= SNIFF_BYTES);
+
+    r = Sniff(BYTES());
+    CheckCommon(r, "empty");
+    CHECK(r.hr == HR_BAD_FORMAT);
+
+    // Sniff_CheckFileType alone gives the same verdicts
+    CSparseStream stream(mp4, mp4.size());
+    ULONG cbRead = 0;
+    CHECK(Sniff_CheckFileType(&stream, &cbRead) == HR_BAD_FORMAT);
+    CHECK(cbRead == stream.bytes_read);
+}
+
+void TestTruncated()
+{
+    BYTES f = File(Meta(3, 2, 4032, 3024));
+
+    // cut inside the meta box
+    BYTES cut(f.begin(), f.begin() + 60);
+    SNIFF_RESULT r = Sniff(cut);
+    CheckCommon(r, "truncated meta");
+    CHECK(r.hr == HR_INVALID_DATA);
+
+    // cut before the meta box: left for libheif, which reports the error
+    BYTES ftyp_only = Ftyp("heic", "mif1heic");
+    r = Sniff(ftyp_only);
+    CheckCommon(r, "ftyp only");
+    CHECK(r.hr == S_OK);
+
+    // cut inside a box header
+    BYTES header_cut = ftyp_only;
+    header_cut.insert(header_cut.end(), { 0, 0, 1 });
+    r = Sniff(header_cut);
+    CheckCommon(r, "truncated box header");
+    CHECK(r.hr == HR_INVALID_DATA);
+
+    // a child box claims more than its parent holds
+    BYTES meta = Meta(3, 0, 640, 480);
+    meta[12 + 3] = 0xff;   // hdlr size, after the meta header and version/flags
+    BYTES bad_child = Ftyp("heic", "mif1heic");
+    Append(&bad_child, meta);
+    r = Sniff(bad_child);
+    CheckCommon(r, "child box overflows meta");
+    CHECK(r.hr == HR_INVALID_DATA);
+}
+
+// Files built to make a parser allocate or loop a lot
+void TestOverLimits()
+{
+    // a meta box declared past SNIFF_MAX_META_BYTES is rejected from its header
+    BYTES huge_meta = Ftyp("heic", "mif1heic");
+    Append32(&huge_meta, 64 * 1024 * 1024);
+    huge_meta.insert(huge_meta.end(), { 'm', 'e', 't', 'a' });
+    SNIFF_RESULT r = Sniff(huge_meta, 256 * 1024 * 1024);
+    CheckCommon(r, "64 MB meta");
+    CHECK(r.hr == HR_INVALID_DATA);
+    CHECK(r.cbRead < 1024);
+
+    r = Sniff(File(Meta(1, 0, 100000, 100000)));
+    CheckCommon(r, "huge ispe");
+    CHECK(r.hr == HR_INVALID_DATA);
+
+    r = Sniff(File(Meta(DEFAULT_MAX_ITEMS + 1, 0, 640, 480)));
+    CheckCommon(r, "too many items");
+    CHECK(r.hr == HR_INVALID_DATA);
+
+    r = Sniff(File(Meta(DEFAULT_MAX_ITEMS, 0, 640, 480)));
+    CheckCommon(r, "most items");
+    CHECK(r.hr == S_OK);
+
+    r = Sniff(File(Meta(3, DEFAULT_MAX_TILES + 1, 640, 480)));
+    CheckCommon(r, "too many tiles");
+    CHECK(r.hr == HR_INVALID_DATA);
+
+    // the limits come from the registry in the handler
+    HEIF_LIMITS saved = *Sniff_GetLimits();
+    HEIF_LIMITS strict = { 2, 1, 1000000 };
+    Sniff_SetLimits(&strict);
+    r = Sniff(File(Meta(3, 0, 640, 480)));
+    CheckCommon(r, "items over a lower limit");
+    CHECK(r.hr == HR_INVALID_DATA);
+    Sniff_SetLimits(&saved);
+}
+
+void TestTopLevelBoxes()
+{
+    // meta after SNIFF_MAX_TOP_LEVEL_BOXES other boxes is not looked for
+    for (UINT free_boxes : { SNIFF_MAX_TOP_LEVEL_BOXES - 2, SNIFF_MAX_TOP_LEVEL_BOXES + 8 })
+    {
+        BYTES f = Ftyp("heic", "mif1heic");
+        for (UINT i = 0; i < free_boxes; ++i)
+            Append(&f, Box("free", BYTES(8, 0)));
+        Append(&f, Meta(3, 0, 640, 480));
+
+        SNIFF_RESULT r = Sniff(f);
+        CheckCommon(r, (free_boxes < SNIFF_MAX_TOP_LEVEL_BOXES) ? "meta after 30 boxes" : "meta after 40 boxes");
+        CHECK(r.hr == ((free_boxes < SNIFF_MAX_TOP_LEVEL_BOXES) ? S_OK : HR_INVALID_DATA));
+    }
+
+    // an 8 GB mdat (64 bit size) in front of meta is seeked over, not read
+    BYTES f = Ftyp("heic", "mif1heic");
+    Append32(&f, 1);
+    f.insert(f.end(), { 'm', 'd', 'a', 't' });
+    UINT64 mdat_size = 8ull * 1024 * 1024 * 1024;
+    Append32(&f, (UINT)(mdat_size >> 32));
+    Append32(&f, (UINT)mdat_size);
+
+    BYTES meta = Meta(1, 0, 100000, 100000);
+    UINT64 size = f.size() - 16 + mdat_size + meta.size();
+
+    CSparseStream stream(f, size, meta);
+    ULONG cbRead = 0;
+    double start = Test_Seconds();
+    HRESULT hr = Sniff_CheckStream(&stream, size, &cbRead);
+    printf("%-28s hr 0x%08x, %7u bytes read, %8.1f us\n", "meta after an 8 GB mdat", (UINT)hr, cbRead, (Test_Seconds() - start) * 1e6);
+
+    // rejected for the ispe in the meta box at the end
+    CHECK(hr == HR_INVALID_DATA);
+    CHECK(cbRead == stream.bytes_read);
+    CHECK(cbRead < SNIFF_BYTES + 64 + meta.size());
+}
+
+// Rejections must not grow with the file: time and memory for a large
+// malformed file stay at those of a small one
+void TestRejectionCost()
+{
+    BYTES items = File(Meta(DEFAULT_MAX_ITEMS * 8, 0, 640, 480));
+
+    Test_ResetPeakRss();
+    long rss_before = Test_RssKB();
+
+    double worst = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        SNIFF_RESULT r = Sniff(items);
+        CHECK(r.hr == HR_INVALID_DATA);
+        worst = fmax(worst, r.seconds);
+    }
+
+    long growth_kb = Test_PeakRssKB() - rss_before;
+    printf("%u items (%zu KB meta): worst %.1f us, peak RSS growth %ld KB\n",
+        DEFAULT_MAX_ITEMS * 8, items.size() / 1024, worst * 1e6, growth_kb);
+
+    // one copy of the meta box and a little slack
+    CHECK(growth_kb < (long)(items.size() / 1024) + 1024);
+    CHECK(worst < 0.05);
+}
+
+int main()
+{
+    TestValid();
+    TestBadFormat();
+    TestTruncated();
+    TestOverLimits();
+    TestTopLevelBoxes();
+    TestRejectionCost();
+
+    return Test_Result();
+}
@@ -0,0 +1,234 @@
+// ToneMap_Create / ToneMap_Apply against a double precision reference, and the
+// properties the thumbnails depend on: SDR passes through unchanged, greys stay
+// grey through the primaries conversion, and BT.2020 colors keep their saturation.
+
+#include <windows.h>
+
+#include <math.h>
+
+#include "tonemap.h"
+#include "tonemap_reference.h"
+#include "test.h"
+
+int test_failures = 0;
+
+heif_color_profile_nclx MakeNclx(heif_transfer_characteristics transfer, heif_color_primaries primaries)
+{
+    heif_color_profile_nclx nclx = {};
+    nclx.transfer_characteristics = transfer;
+    nclx.color_primaries = primaries;
+    return nclx;
+}
+
+// Small deterministic generator, so failures reproduce
+UINT NextRandom(UINT64* state)
+{
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (UINT)(*state >> 33);
+}
+
+// Every output channel within one step of the reference, over all greys and
+// a spread of colors
+void TestAgainstReference(int bit_depth, heif_transfer_characteristics transfer, heif_color_primaries primaries)
+{
+    heif_color_profile_nclx nclx = MakeNclx(transfer, primaries);
+    TONEMAP* tm = ToneMap_Create(bit_depth, &nclx);
+    CHECK(tm != NULL);
+    if (!tm)
+        return;
+
+    UINT max_value = (1u << bit_depth) - 1;
+    double worst = 0;
+    double total = 0;
+    int count = 0;
+
+    UINT64 state = 1;
+    for (int i = 0; i < 100000 + (int)max_value + 1; ++i)
+    {
+        UINT r, g, b;
+        if (i <= (int)max_value)
+        {
+            r = g = b = (UINT)i;
+        }
+        else
+        {
+            r = NextRandom(&state) % (max_value + 1);
+            g = NextRandom(&state) % (max_value + 1);
+            b = NextRandom(&state) % (max_value + 1);
+        }
+
+        BYTE rgb[3];
+        ToneMap_Apply(tm, r, g, b, rgb);
+        REFERENCE_RGB ref = Reference_ToneMap(transfer, primaries,
+            (double)r / max_value, (double)g / max_value, (double)b / max_value);
+
+        double errors[3] = { fabs(rgb[0] - ref.r), fabs(rgb[1] - ref.g), fabs(rgb[2] - ref.b) };
+        for (int c = 0; c < 3; ++c)
+        {
+            worst = fmax(worst, errors[c]);
+            total += errors[c];
+            ++count;
+        }
+    }
+
+    printf("%2i bit, transfer %2i, primaries %2i: worst error %.3f, mean %.3f\n",
+        bit_depth, (int)transfer, (int)primaries, worst, total / count);
+
+    // rounding alone is up to 0.5, the float table and matrix add a little
+    CHECK(worst < 1.0);
+    CHECK(total / count < 0.3);
+
+    LocalFree(tm);
+}
+
+// 8 bit sRGB and unspecified profiles come out as they went in
+void TestSdrIdentity()
+{
+    heif_color_profile_nclx srgb = MakeNclx(heif_transfer_characteristic_IEC_61966_2_1, heif_color_primaries_ITU_R_BT_709_5);
+    const heif_color_profile_nclx* profiles[] = { NULL, &srgb };
+
+    for (const heif_color_profile_nclx* nclx : profiles)
+    {
+        TONEMAP* tm = ToneMap_Create(8, nclx);
+        CHECK(tm != NULL);
+        if (!tm)
+            continue;
+
+        int mismatches = 0;
+        for (UINT v = 0; v < 256; ++v)
+        {
+            BYTE rgb[3];
+            ToneMap_Apply(tm, v, 255 - v, (v * 7) & 255, rgb);
+            if (rgb[0] != v || rgb[1] != 255 - v || rgb[2] != ((v * 7) & 255))
+                ++mismatches;
+        }
+        CHECK(mismatches == 0);
+
+        LocalFree(tm);
+    }
+}
+
+// Rows of the primaries matrices sum to one, so greys must stay grey
+void TestNeutralGreys()
+{
+    heif_transfer_characteristics transfers[] =
+    {
+        heif_transfer_characteristic_ITU_R_BT_2100_0_PQ,
+        heif_transfer_characteristic_ITU_R_BT_2100_0_HLG,
+    };
+
+    for (heif_transfer_characteristics transfer : transfers)
+    {
+        heif_color_profile_nclx nclx = MakeNclx(transfer, heif_color_primaries_ITU_R_BT_2020_2_and_2100_0);
+        TONEMAP* tm = ToneMap_Create(10, &nclx);
+        CHECK(tm != NULL);
+        if (!tm)
+            continue;
+
+        int worst = 0;
+        for (UINT v = 0; v < 1024; ++v)
+        {
+            BYTE rgb[3];
+            ToneMap_Apply(tm, v, v, v, rgb);
+            worst = max(worst, max(abs(rgb[0] - rgb[1]), abs(rgb[1] - rgb[2])));
+        }
+        CHECK(worst <= 1);
+
+        // black stays black and the brightest code is white
+        BYTE black[3];
+        BYTE white[3];
+        ToneMap_Apply(tm, 0, 0, 0, black);
+        ToneMap_Apply(tm, 1023, 1023, 1023, white);
+        CHECK(black[0] == 0 && black[1] == 0 && black[2] == 0);
+        CHECK(white[0] >= 254 && white[1] >= 254 && white[2] >= 254);
+
+        LocalFree(tm);
+    }
+}
+
+// BT.2020 and P3 colors read as BT.709 come out washed out; with the
+// conversion they keep more saturation
+void TestSaturation()
+{
+    heif_color_primaries wide[] = { heif_color_primaries_ITU_R_BT_2020_2_and_2100_0, heif_color_primaries_SMPTE_EG_432_1 };
+
+    for (heif_color_primaries primaries : wide)
+    {
+        heif_color_profile_nclx converted = MakeNclx(heif_transfer_characteristic_ITU_R_BT_2100_0_PQ, primaries);
+        heif_color_profile_nclx unconverted = MakeNclx(heif_transfer_characteristic_ITU_R_BT_2100_0_PQ, heif_color_primaries_ITU_R_BT_709_5);
+        TONEMAP* tm = ToneMap_Create(10, &converted);
+        TONEMAP* tm_709 = ToneMap_Create(10, &unconverted);
+        CHECK(tm != NULL && tm_709 != NULL);
+        if (tm && tm_709)
+        {
+            // a muted red, then a muted green, around reference white
+            UINT colors[2][3] = { { 560, 480, 480 }, { 470, 540, 470 } };
+            for (const UINT* color : colors)
+            {
+                BYTE rgb[3];
+                BYTE rgb_709[3];
+                ToneMap_Apply(tm, color[0], color[1], color[2], rgb);
+                ToneMap_Apply(tm_709, color[0], color[1], color[2], rgb_709);
+
+                int chroma = max(rgb[0], max(rgb[1], rgb[2])) - min(rgb[0], min(rgb[1], rgb[2]));
+                int chroma_709 = max(rgb_709[0], max(rgb_709[1], rgb_709[2])) - min(rgb_709[0], min(rgb_709[1], rgb_709[2]));
+                CHECK(chroma > chroma_709);
+            }
+        }
+
+        LocalFree(tm);
+        LocalFree(tm_709);
+    }
+
+    // PQ without primaries is BT.2100, so it is converted too
+    heif_color_profile_nclx unspecified = MakeNclx(heif_transfer_characteristic_ITU_R_BT_2100_0_PQ, heif_color_primaries_unspecified);
+    TONEMAP* tm = ToneMap_Create(10, &unspecified);
+    CHECK(tm != NULL && tm->convert_primaries);
+    LocalFree(tm);
+}
+
+void TestInvalidArguments()
+{
+    CHECK(ToneMap_Create(7, NULL) == NULL);
+    CHECK(ToneMap_Create(17, NULL) == NULL);
+
+    // out of range samples are clamped rather than read past the table
+    TONEMAP* tm = ToneMap_Create(10, NULL);
+    CHECK(tm != NULL);
+    if (tm)
+    {
+        BYTE rgb[3];
+        ToneMap_Apply(tm, 5000, 1023, 0, rgb);
+        CHECK(rgb[0] == 255 && rgb[1] == 255 && rgb[2] == 0);
+        LocalFree(tm);
+    }
+}
+
+int main()
+{
+    int depths[] = { 8, 10, 12 };
+    heif_transfer_characteristics transfers[] =
+    {
+        heif_transfer_characteristic_ITU_R_BT_2100_0_PQ,
+        heif_transfer_characteristic_ITU_R_BT_2100_0_HLG,
+        heif_transfer_characteristic_IEC_61966_2_1,
+    };
+    heif_color_primaries primaries[] =
+    {
+        heif_color_primaries_ITU_R_BT_709_5,
+        heif_color_primaries_ITU_R_BT_2020_2_and_2100_0,
+        heif_color_primaries_SMPTE_EG_432_1,
+    };
+
+    for (int bit_depth : depths)
+        for (heif_transfer_characteristics transfer : transfers)
+            for (heif_color_primaries p : primaries)
+                TestAgainstReference(bit_depth, transfer, p);
+
+    TestSdrIdentity();
+    TestNeutralGreys();
+    TestSaturation();
+    TestInvalidArguments();
+
+    return Test_Result();
+}
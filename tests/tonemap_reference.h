@@ -0,0 +1,106 @@
+#pragma once
+
+#include <math.h>
+
+// Straight double precision version of the tone mapping pipeline, from the
+// BT.2100, BT.2087 and sRGB formulas, with no tables and no rounding before
+// the end. test_tonemap and bench_tonemap measure ToneMap_Apply against it.
+
+struct REFERENCE_RGB
+{
+    double r, g, b;
+};
+
+inline double Reference_PQ(double e)
+{
+    const double m1 = 2610.0 / 16384.0;
+    const double m2 = 2523.0 / 4096.0 * 128.0;
+    const double c1 = 3424.0 / 4096.0;
+    const double c2 = 2413.0 / 4096.0 * 32.0;
+    const double c3 = 2392.0 / 4096.0 * 32.0;
+
+    double p = pow(e, 1.0 / m2);
+    return pow(fmax(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1) * 10000.0;
+}
+
+inline double Reference_HLG(double e)
+{
+    const double a = 0.17883277;
+    const double b = 1.0 - 4.0 * a;
+    const double c = 0.5 - a * log(4.0 * a);
+
+    return (e <= 0.5) ? (e * e / 3.0) : ((exp((e - c) / a) + b) / 12.0);
+}
+
+inline double Reference_SRGB(double l)
+{
+    l = fmin(fmax(l, 0.0), 1.0);
+    return (l <= 0.0031308) ? (l * 12.92) : (1.055 * pow(l, 1.0 / 2.4) - 0.055);
+}
+
+inline double Reference_SRGBToLinear(double e)
+{
+    return (e <= 0.04045) ? (e / 12.92) : pow((e + 0.055) / 1.055, 2.4);
+}
+
+inline double Reference_Reinhard(double l)
+{
+    const double white = 1000.0 / 203.0;
+    return l * (1.0 + l / (white * white)) / (1.0 + l);
+}
+
+// transfer is 16 (PQ), 18 (HLG) or anything else for sRGB; primaries is 9
+// (BT.2020), 12 (Display P3) or anything else for BT.709. r, g and b are
+// normalized code values 0..1; the result is 0..255, not yet rounded.
+inline REFERENCE_RGB Reference_ToneMap(int transfer, int primaries, double r, double g, double b)
+{
+    static const double bt2020[3][3] =
+    {
+        {  1.6605, -0.5876, -0.0728 },
+        { -0.1246,  1.1329, -0.0083 },
+        { -0.0182, -0.1006,  1.1187 },
+    };
+    static const double p3[3][3] =
+    {
+        {  1.2249, -0.2247,  0.0000 },
+        { -0.0420,  1.0419,  0.0000 },
+        { -0.0197, -0.0786,  1.0979 },
+    };
+
+    double c[3] = { r, g, b };
+    for (int i = 0; i < 3; ++i)
+    {
+        if (transfer == 16)
+            c[i] = Reference_PQ(c[i]) / 203.0;
+        else if (transfer == 18)
+            c[i] = Reference_HLG(c[i]);
+        else
+            c[i] = Reference_SRGBToLinear(c[i]);
+    }
+
+    if (transfer == 18)
+    {
+        double ys = 0.2627 * c[0] + 0.6780 * c[1] + 0.0593 * c[2];
+        double scale = (ys > 0.0) ? (1000.0 / 203.0) * pow(ys, 0.2) : 0.0;
+        for (int i = 0; i < 3; ++i)
+            c[i] *= scale;
+    }
+
+    const double (*m)[3] = (primaries == 9) ? bt2020 : (primaries == 12) ? p3 : NULL;
+    if (m)
+    {
+        double s[3] = { c[0], c[1], c[2] };
+        for (int i = 0; i < 3; ++i)
+            c[i] = m[i][0] * s[0] + m[i][1] * s[1] + m[i][2] * s[2];
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        double l = fmax(c[i], 0.0);
+        if (transfer == 16 || transfer == 18)
+            l = Reference_Reinhard(l);
+        c[i] = Reference_SRGB(l) * 255.0;
+    }
+
+    return { c[0], c[1], c[2] };
+}
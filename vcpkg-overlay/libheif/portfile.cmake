@@ -6,13 +6,14 @@ vcpkg_from_github(
     HEAD_REF master
     PATCHES
         gdk-pixbuf.patch
+        dav1d-threads.patch
 )
 
 vcpkg_cmake_configure(
     SOURCE_PATH "${SOURCE_PATH}"
     OPTIONS
         -DWITH_EXAMPLES=OFF
-        -DWITH_DAV1D=OFF
+        -DWITH_DAV1D=ON
         -DWITH_X265=OFF
 )
 vcpkg_cmake_install()